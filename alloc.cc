@@ -0,0 +1,45 @@
+#include "lisp.h"
+
+#include <new>
+
+thread_local SmallFreeLists *small_free_lists = nullptr;
+
+static SmallFreeLists *current_lists() {
+    if (! small_free_lists) {
+        small_free_lists = (SmallFreeLists *)GC_MALLOC_UNCOLLECTABLE(sizeof(SmallFreeLists));
+        if (! small_free_lists)
+            throw bad_alloc();
+    }
+    return small_free_lists;
+}
+
+SmallFreeLists *small_alloc_lists() try {
+    return current_lists();
+} catch (...) {
+    static SmallFreeLists no_lists;
+    return &no_lists;
+}
+
+void *small_alloc_refill(size_t cls) {
+    SmallFreeLists *lists = current_lists();
+    void *batch = GC_malloc_many(cls * SMALL_GRANULE);
+    if (! batch)
+        throw bad_alloc();
+
+    lists->heads[cls] = GC_NEXT(batch);
+    GC_NEXT(batch) = nullptr;
+    return batch;
+}
+
+void *small_alloc_jit_refill(size_t cls) try {
+    return small_alloc_refill(cls);
+} catch (...) {
+    return hold_error<void*>();
+}
+
+void small_alloc_release() {
+    if (small_free_lists) {
+        GC_FREE(small_free_lists);
+        small_free_lists = nullptr;
+    }
+}
@@ -0,0 +1,105 @@
+#include "lisp.h"
+
+#include <functional>
+
+static Number *num_arg(Form *f, const char *op) {
+    Number *n = dyn_cast_or_null<Number>(f);
+    if (! n)
+        throw TypeError(string(op) + " requires numbers", f);
+    return n;
+}
+
+// int_op reports overflow like __builtin_add_overflow.
+template<typename IntOp, typename FloatOp>
+static Form *arith(Form *a, Form *b, const char *op, IntOp int_op, FloatOp float_op) try {
+    Number *x = num_arg(a, op), *y = num_arg(b, op);
+    if (isa<Int>(x) && isa<Int>(y)) {
+        long r;
+        if (int_op(long_val(x), long_val(y), &r))
+            throw LispException(string("Integer overflow in ") + op);
+        return make_int(r);
+    }
+    return make_float(float_op(double_val(x), double_val(y)));
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_add(Form *a, Form *b) {
+    return arith(a, b, "+",
+                 [](long x, long y, long *r) { return __builtin_add_overflow(x, y, r); },
+                 [](double x, double y) { return x + y; });
+}
+
+Form *builtin_sub(Form *a, Form *b) {
+    return arith(a, b, "-",
+                 [](long x, long y, long *r) { return __builtin_sub_overflow(x, y, r); },
+                 [](double x, double y) { return x - y; });
+}
+
+Form *builtin_mul(Form *a, Form *b) {
+    return arith(a, b, "*",
+                 [](long x, long y, long *r) { return __builtin_mul_overflow(x, y, r); },
+                 [](double x, double y) { return x * y; });
+}
+
+// Integers that don't divide exactly give a float rather than truncating.
+Form *builtin_div(Form *a, Form *b) try {
+    Number *x = num_arg(a, "/"), *y = num_arg(b, "/");
+    if (isa<Int>(x) && isa<Int>(y)) {
+        long n = long_val(x), d = long_val(y);
+        if (d == 0)
+            throw LispException("Division by zero");
+        if (d == -1 && n == LONG_MIN)
+            throw LispException("Integer overflow in /");
+        if (n % d == 0)
+            return make_int(n / d);
+        return make_float((double)n / d);
+    }
+    return make_float(double_val(x) / double_val(y));
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+template<template<typename> class Cmp>
+static Form *compare(Form *a, Form *b, const char *op) try {
+    Number *x = num_arg(a, op), *y = num_arg(b, op);
+    bool r = isa<Int>(x) && isa<Int>(y)
+        ? Cmp<long>()(long_val(x), long_val(y))
+        : Cmp<double>()(double_val(x), double_val(y));
+    return r ? Symbol::T : NIL;
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_lt(Form *a, Form *b) { return compare<less>(a, b, "<"); }
+Form *builtin_le(Form *a, Form *b) { return compare<less_equal>(a, b, "<="); }
+Form *builtin_num_eq(Form *a, Form *b) { return compare<equal_to>(a, b, "="); }
+Form *builtin_ge(Form *a, Form *b) { return compare<greater_equal>(a, b, ">="); }
+Form *builtin_gt(Form *a, Form *b) { return compare<greater>(a, b, ">"); }
+
+Form *box_long(long l) try {
+    return make_int(l);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *box_double(double d) try {
+    return make_float(d);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+long unbox_long(Form *f) try {
+    Int *i = dyn_cast_or_null<Int>(f);
+    if (! i)
+        throw TypeError("Expected an integer", f);
+    return long_val(i);
+} catch (...) {
+    return hold_error<long>();
+}
+
+double unbox_double(Form *f) try {
+    return double_val(num_arg(f, "Conversion to double"));
+} catch (...) {
+    return hold_error<double>();
+}
@@ -0,0 +1,387 @@
+#include "lisp.h"
+
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+template<typename T, Form::FormKind K>
+NumArray<T, K> *NumArray<T, K>::make(size_t n) {
+    if (n > UINT_MAX)
+        throw LispException("Array too large.");
+    size_t size = sizeof(NumArray) + n * sizeof(T);
+    void *mem = GC_MALLOC_ATOMIC(size);
+    if (! mem)
+        throw bad_alloc();
+    // Atomic memory isn't cleared for us.
+    memset(mem, 0, size);
+    return new (mem) NumArray(n);
+}
+
+template class NumArray<double, Form::FK_F64Array>;
+template class NumArray<long, Form::FK_I64Array>;
+
+// Double kernels, 4 (AVX) or 2 (SSE2) lanes at a time with a scalar tail.
+// Sums reassociate across lanes, so they can differ from a left-to-right
+// sum in the last bits.
+static double f64_sum(const double *a, size_t n) {
+    size_t i = 0;
+    double total = 0;
+#if defined(__AVX__)
+    __m256d acc = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+    __m128d acc = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_add_pd(acc, _mm_loadu_pd(a + i));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; ++i)
+        total += a[i];
+    return total;
+}
+
+static double f64_dot(const double *a, const double *b, size_t n) {
+    size_t i = 0;
+    double total = 0;
+#if defined(__AVX__)
+    __m256d acc = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+    __m128d acc = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; ++i)
+        total += a[i] * b[i];
+    return total;
+}
+
+static void f64_add(double *out, const double *a, const double *b, size_t n) {
+    size_t i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+#elif defined(__SSE2__)
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+#endif
+    for (; i < n; ++i)
+        out[i] = a[i] + b[i];
+}
+
+static void f64_scale(double *out, const double *a, double k, size_t n) {
+    size_t i = 0;
+#if defined(__AVX__)
+    __m256d kv = _mm256_set1_pd(k);
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), kv));
+#elif defined(__SSE2__)
+    __m128d kv = _mm_set1_pd(k);
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), kv));
+#endif
+    for (; i < n; ++i)
+        out[i] = a[i] * k;
+}
+
+// n must be at least 1. NaNs are not ordered consistently.
+static double f64_min(const double *a, size_t n) {
+    size_t i = 0;
+    double m = a[0];
+#if defined(__AVX__)
+    if (n >= 4) {
+        __m256d acc = _mm256_loadu_pd(a);
+        for (i = 4; i + 4 <= n; i += 4)
+            acc = _mm256_min_pd(acc, _mm256_loadu_pd(a + i));
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc);
+        for (double l : lanes)
+            m = l < m ? l : m;
+    }
+#elif defined(__SSE2__)
+    if (n >= 2) {
+        __m128d acc = _mm_loadu_pd(a);
+        for (i = 2; i + 2 <= n; i += 2)
+            acc = _mm_min_pd(acc, _mm_loadu_pd(a + i));
+        double lanes[2];
+        _mm_storeu_pd(lanes, acc);
+        for (double l : lanes)
+            m = l < m ? l : m;
+    }
+#endif
+    for (; i < n; ++i)
+        m = a[i] < m ? a[i] : m;
+    return m;
+}
+
+static double f64_max(const double *a, size_t n) {
+    size_t i = 0;
+    double m = a[0];
+#if defined(__AVX__)
+    if (n >= 4) {
+        __m256d acc = _mm256_loadu_pd(a);
+        for (i = 4; i + 4 <= n; i += 4)
+            acc = _mm256_max_pd(acc, _mm256_loadu_pd(a + i));
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc);
+        for (double l : lanes)
+            m = l > m ? l : m;
+    }
+#elif defined(__SSE2__)
+    if (n >= 2) {
+        __m128d acc = _mm_loadu_pd(a);
+        for (i = 2; i + 2 <= n; i += 2)
+            acc = _mm_max_pd(acc, _mm_loadu_pd(a + i));
+        double lanes[2];
+        _mm_storeu_pd(lanes, acc);
+        for (double l : lanes)
+            m = l > m ? l : m;
+    }
+#endif
+    for (; i < n; ++i)
+        m = a[i] > m ? a[i] : m;
+    return m;
+}
+
+// Integer kernels are plain loops for the compiler to vectorize: SSE2 and
+// AVX2 have no 64-bit multiply or min/max to write them with. Overflow
+// wraps.
+static long i64_sum(const long *__restrict a, size_t n) {
+    unsigned long total = 0;
+    for (size_t i = 0; i < n; ++i)
+        total += a[i];
+    return total;
+}
+
+static long i64_dot(const long *__restrict a, const long *__restrict b, size_t n) {
+    unsigned long total = 0;
+    for (size_t i = 0; i < n; ++i)
+        total += (unsigned long)a[i] * b[i];
+    return total;
+}
+
+static void i64_add(long *__restrict out, const long *__restrict a, const long *__restrict b, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (unsigned long)a[i] + b[i];
+}
+
+static void i64_scale(long *__restrict out, const long *__restrict a, long k, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (unsigned long)a[i] * k;
+}
+
+static long i64_min(const long *__restrict a, size_t n) {
+    long m = a[0];
+    for (size_t i = 1; i < n; ++i)
+        m = a[i] < m ? a[i] : m;
+    return m;
+}
+
+static long i64_max(const long *__restrict a, size_t n) {
+    long m = a[0];
+    for (size_t i = 1; i < n; ++i)
+        m = a[i] > m ? a[i] : m;
+    return m;
+}
+
+// A count makes a zeroed array, a vector or list of numbers is converted.
+template<typename A, typename Conv>
+static A *make_array(Form *src, const char *op, Conv conv) {
+    if (Int *n = dyn_cast_or_null<Int>(src)) {
+        if (long_val(n) < 0)
+            throw IndexError(string(op) + " size must not be negative");
+        return A::make(long_val(n));
+    }
+
+    if (Vector *v = dyn_cast_or_null<Vector>(src)) {
+        A *a = A::make(v->count());
+        for (size_t i = 0; i < v->count(); ++i) {
+            Number *num = dyn_cast_or_null<Number>(v->nth(i));
+            if (! num)
+                throw TypeError(string(op) + " elements must be numbers", v->nth(i));
+            a->data()[i] = conv(num);
+        }
+        return a;
+    }
+
+    if (! listp(src))
+        throw TypeError(string(op) + " requires a size, a vector or a proper list", src);
+    A *a = A::make(count(cast_or_null<Pair>(src)));
+    size_t i = 0;
+    for (Pair *p = cast_or_null<Pair>(src); p; p = cast_or_null<Pair>(p->cdr())) {
+        Number *num = dyn_cast_or_null<Number>(p->car());
+        if (! num)
+            throw TypeError(string(op) + " elements must be numbers", p->car());
+        a->data()[i++] = conv(num);
+    }
+    return a;
+}
+
+Form *builtin_f64_array(Form *src) try {
+    return make_array<F64Array>(src, "f64-array", double_val);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_i64_array(Form *src) try {
+    return make_array<I64Array>(src, "i64-array", long_val);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+static size_t array_index(Form *index, size_t count, const char *op) {
+    Int *i = dyn_cast_or_null<Int>(index);
+    if (! i)
+        throw TypeError(string(op) + " index must be an integer", index);
+    long l = long_val(i);
+    if (l < 0 || (unsigned long)l >= count)
+        throw IndexError(string(op) + " index out of bounds: " + print_int(i));
+    return l;
+}
+
+Form *builtin_aget(Form *arr, Form *index) try {
+    if (F64Array *a = dyn_cast_or_null<F64Array>(arr))
+        return make_float(a->data()[array_index(index, a->count(), "aget")]);
+    if (I64Array *a = dyn_cast_or_null<I64Array>(arr))
+        return make_int(a->data()[array_index(index, a->count(), "aget")]);
+    throw TypeError("aget requires an f64 or i64 array", arr);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+// Stores x, converted to the array's element type, and returns it.
+Form *builtin_aset(Form *arr, Form *index, Form *x) try {
+    Number *num = dyn_cast_or_null<Number>(x);
+    if (! num)
+        throw TypeError("aset! value must be a number", x);
+
+    if (F64Array *a = dyn_cast_or_null<F64Array>(arr))
+        a->data()[array_index(index, a->count(), "aset!")] = double_val(num);
+    else if (I64Array *a = dyn_cast_or_null<I64Array>(arr))
+        a->data()[array_index(index, a->count(), "aset!")] = long_val(num);
+    else
+        throw TypeError("aset! requires an f64 or i64 array", arr);
+    return x;
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_array_sum(Form *arr) try {
+    if (F64Array *a = dyn_cast_or_null<F64Array>(arr))
+        return make_float(f64_sum(a->data(), a->count()));
+    if (I64Array *a = dyn_cast_or_null<I64Array>(arr))
+        return make_int(i64_sum(a->data(), a->count()));
+    throw TypeError("array-sum requires an f64 or i64 array", arr);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+// Both arguments must be arrays of the same type and length.
+template<typename A>
+static A *other_array(Form *b, A *a, const char *op) {
+    A *other = dyn_cast_or_null<A>(b);
+    if (! other)
+        throw TypeError(string(op) + " requires two arrays of the same type", b);
+    if (other->count() != a->count())
+        throw IndexError(string(op) + " requires arrays of the same length");
+    return other;
+}
+
+Form *builtin_array_dot(Form *a, Form *b) try {
+    if (F64Array *fa = dyn_cast_or_null<F64Array>(a))
+        return make_float(f64_dot(fa->data(), other_array(b, fa, "array-dot")->data(), fa->count()));
+    if (I64Array *ia = dyn_cast_or_null<I64Array>(a))
+        return make_int(i64_dot(ia->data(), other_array(b, ia, "array-dot")->data(), ia->count()));
+    throw TypeError("array-dot requires an f64 or i64 array", a);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_array_add(Form *a, Form *b) try {
+    if (F64Array *fa = dyn_cast_or_null<F64Array>(a)) {
+        F64Array *fb = other_array(b, fa, "array-add");
+        F64Array *out = F64Array::make(fa->count());
+        f64_add(out->data(), fa->data(), fb->data(), fa->count());
+        return out;
+    }
+    if (I64Array *ia = dyn_cast_or_null<I64Array>(a)) {
+        I64Array *ib = other_array(b, ia, "array-add");
+        I64Array *out = I64Array::make(ia->count());
+        i64_add(out->data(), ia->data(), ib->data(), ia->count());
+        return out;
+    }
+    throw TypeError("array-add requires an f64 or i64 array", a);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_array_scale(Form *arr, Form *k) try {
+    if (F64Array *a = dyn_cast_or_null<F64Array>(arr)) {
+        Number *num = dyn_cast_or_null<Number>(k);
+        if (! num)
+            throw TypeError("array-scale factor must be a number", k);
+        F64Array *out = F64Array::make(a->count());
+        f64_scale(out->data(), a->data(), double_val(num), a->count());
+        return out;
+    }
+    if (I64Array *a = dyn_cast_or_null<I64Array>(arr)) {
+        Int *num = dyn_cast_or_null<Int>(k);
+        if (! num)
+            throw TypeError("array-scale factor for an i64 array must be an integer", k);
+        I64Array *out = I64Array::make(a->count());
+        i64_scale(out->data(), a->data(), long_val(num), a->count());
+        return out;
+    }
+    throw TypeError("array-scale requires an f64 or i64 array", arr);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_array_min(Form *arr) try {
+    if (F64Array *a = dyn_cast_or_null<F64Array>(arr)) {
+        if (! a->count())
+            throw IndexError("array-min of an empty array");
+        return make_float(f64_min(a->data(), a->count()));
+    }
+    if (I64Array *a = dyn_cast_or_null<I64Array>(arr)) {
+        if (! a->count())
+            throw IndexError("array-min of an empty array");
+        return make_int(i64_min(a->data(), a->count()));
+    }
+    throw TypeError("array-min requires an f64 or i64 array", arr);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_array_max(Form *arr) try {
+    if (F64Array *a = dyn_cast_or_null<F64Array>(arr)) {
+        if (! a->count())
+            throw IndexError("array-max of an empty array");
+        return make_float(f64_max(a->data(), a->count()));
+    }
+    if (I64Array *a = dyn_cast_or_null<I64Array>(arr)) {
+        if (! a->count())
+            throw IndexError("array-max of an empty array");
+        return make_int(i64_max(a->data(), a->count()));
+    }
+    throw TypeError("array-max requires an f64 or i64 array", arr);
+} catch (...) {
+    return hold_error<Form*>();
+}
@@ -0,0 +1,93 @@
+// Heap bytes and traversal time per cons cell, for the current Pair next to
+// the old layout (vtable pointer, then kind, then car and cdr), and for a
+// list built in one piece by list_from_array.
+#include "lisp.h"
+
+#include <chrono>
+#include <cstdlib>
+
+using namespace std::chrono;
+
+struct LegacyPair : public gc {
+    int kind;
+    Form *car;
+    LegacyPair *cdr;
+
+    LegacyPair(Form *a, LegacyPair *d) : kind(Form::FK_Pair), car(a), cdr(d) {}
+    virtual ~LegacyPair() {}
+};
+
+struct Timing {
+    size_t gc_before;
+    steady_clock::time_point start;
+    double build;
+    size_t bytes;
+
+    Timing() : gc_before(GC_get_total_bytes()), start(steady_clock::now()) {}
+
+    void built() {
+        build = duration<double>(steady_clock::now() - start).count();
+        bytes = GC_get_total_bytes() - gc_before;
+        start = steady_clock::now();
+    }
+
+    void walked(const char *layout, size_t size, long n, long sum) {
+        double walk = duration<double>(steady_clock::now() - start).count();
+        printf("{\"layout\": \"%s\", \"cells\": %ld, \"sizeof\": %zu, \"gc_bytes_per_cons\": %.1f, "
+               "\"build_ns_per_cons\": %.2f, \"walk_ns_per_cons\": %.2f, \"checksum\": %ld}\n",
+               layout, n, size, (double)bytes / n, build * 1e9 / n, walk * 1e9 / n, sum);
+    }
+};
+
+void run_legacy(long n) {
+    GC_gcollect();
+    Timing t;
+    LegacyPair *head = nullptr;
+    for (long i = 0; i < n; ++i)
+        head = new LegacyPair(make_int(i), head);
+    t.built();
+
+    long sum = 0;
+    for (LegacyPair *p = head; p; p = p->cdr)
+        sum += long_val(cast<Number>(p->car));
+    t.walked("vtable", sizeof(LegacyPair), n, sum);
+}
+
+void run_current(long n) {
+    GC_gcollect();
+    Timing t;
+    Pair *head = NIL;
+    for (long i = 0; i < n; ++i)
+        head = cons(make_int(i), head);
+    t.built();
+
+    long sum = 0;
+    for (Pair *p = head; p; p = cast_or_null<Pair>(p->cdr()))
+        sum += long_val(cast<Number>(p->car()));
+    t.walked("current", sizeof(Pair), n, sum);
+}
+
+void run_contiguous(long n) {
+    GC_gcollect();
+    FormVector elems(n);
+    for (long i = 0; i < n; ++i)
+        elems[i] = make_int(n - 1 - i);
+    Timing t;
+    Pair *head = cast<Pair>(list_from_array(elems.data(), n));
+    t.built();
+
+    long sum = 0;
+    for (Pair *p = head; p; p = cast_or_null<Pair>(p->cdr()))
+        sum += long_val(cast<Number>(p->car()));
+    t.walked("contiguous", sizeof(Pair), n, sum);
+}
+
+int main(int argc, char *argv[]) {
+    GC_INIT();
+    long n = argc > 1 ? atol(argv[1]) : 4000000;
+
+    run_legacy(n);
+    run_current(n);
+    run_contiguous(n);
+    return 0;
+}
@@ -0,0 +1,56 @@
+// How many computed doubles make_float still boxes on the heap, for a few
+// kinds of float arithmetic, next to the old scheme that only kept doubles
+// with two clear low mantissa bits inline.
+#include "lisp.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std::chrono;
+
+struct Workload {
+    const char *name;
+    double (*step)(long i, double prev);
+};
+
+double uniform() { return rand() / (RAND_MAX + 1.0); }
+
+const Workload WORKLOADS[] = {
+    { "running_sum", [](long, double prev) { return prev + uniform(); } },
+    { "products",    [](long, double) { return (0.5 + uniform()) * (0.5 + uniform()); } },
+    { "ratios",      [](long i, double) { return (double)i / (i + 3); } },
+    { "sqrt",        [](long i, double) { return sqrt((double)i); } },
+    { "oscillator",  [](long i, double prev) { return i % 2 ? prev * 0.999 : prev - 0.001 * cos(prev); } },
+    { "tiny_steps",  [](long, double prev) { return prev * 1e-3 + 1e-9; } },
+    // Restarts at 1 every 4000 steps; falls below 1e-77 after ~1700.
+    { "decay",       [](long i, double prev) { return i % 4000 ? prev * 0.9 : 1.0; } },
+};
+
+void run(const Workload &w, long n) {
+    srand(42);
+    long old_boxed = 0, boxed = 0;
+    double x = 1.0, sum = 0;
+    auto start = steady_clock::now();
+    for (long i = 0; i < n; ++i) {
+        x = w.step(i, x);
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        old_boxed += (bits & IMMEDIATE_MASK) != 0;
+        Number *num = make_float(x);
+        boxed += ! is_flonum(num);
+        sum += double_val(num);
+    }
+    double secs = duration<double>(steady_clock::now() - start).count();
+    printf("{\"workload\": \"%s\", \"values\": %ld, \"old_heap_pct\": %.2f, \"heap_pct\": %.4f, "
+           "\"ns_per_value\": %.2f, \"checksum\": %g}\n",
+           w.name, n, 100.0 * old_boxed / n, 100.0 * boxed / n, secs * 1e9 / n, sum);
+}
+
+int main(int argc, char *argv[]) {
+    GC_INIT();
+    long n = argc > 1 ? atol(argv[1]) : 10000000;
+    for (const Workload &w : WORKLOADS)
+        run(w, n);
+    return 0;
+}
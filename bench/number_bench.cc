@@ -0,0 +1,140 @@
+// Compares the stringstream-based read_number the reader used to have with
+// the allocation-free scanner, over the same corpus of literals.
+#include "lisp.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+
+using namespace std::chrono;
+
+inline bool is_whitespace(char c) { return isspace(c) || c == ','; }
+inline bool is_sym_char(char c) { return !is_whitespace(c) && c != '(' && c != ')'; }
+
+// The pre-scanner read_number, kept verbatim (less the symbol fallback) as
+// the baseline.
+Form *legacy_read_number(istream &input) {
+    stringstream num_stream;
+    char cur = input.get();
+    num_stream << cur;
+
+    if (cur == '-' || cur == '+') {
+        cur = input.get();
+        num_stream << cur;
+    }
+
+    if (cur == '0') {
+        if (!is_sym_char(input.peek()))
+            return new Int(0);
+
+        cur = input.get();
+        num_stream << cur;
+        char dispatch = cur;
+
+        while (is_sym_char(cur = input.get()))
+            num_stream << cur;
+        input.putback(cur);
+
+        Number *rval;
+        if (dispatch == '.') {
+            double d;
+            num_stream >> d;
+            rval = new Float(d);
+        } else {
+            long l;
+            if (dispatch == 'x' || dispatch == 'X')
+                num_stream >> hex >> l;
+            else
+                num_stream >> oct >> l;
+            rval = new Int(l);
+        }
+        if (!num_stream.eof())
+            throw ReaderError("Invalid number format: ", num_stream.str());
+        return rval;
+    }
+
+    bool is_float = false;
+    while (is_sym_char(cur = input.get())) {
+        num_stream << cur;
+        if (cur == '.')
+            is_float = true;
+    }
+    input.putback(cur);
+
+    Number *rval;
+    if (is_float) {
+        double num;
+        num_stream >> num;
+        rval = new Float(num);
+    } else {
+        long num;
+        num_stream >> num;
+        rval = new Int(num);
+    }
+    if (!num_stream.eof())
+        throw ReaderError("Invalid number format: ", num_stream.str());
+    return rval;
+}
+
+string make_corpus(int n) {
+    srand(42);
+    ostringstream out;
+    for (int i = 0; i < n; ++i) {
+        switch (rand() % 4) {
+        case 0: out << rand() % 100000; break;
+        case 1: out << "-0x" << hex << rand() << dec; break;
+        case 2: out << "0" << oct << rand() % 4096 + 1 << dec; break;
+        case 3: out << rand() % 1000 << "." << rand() % 1000; break;
+        }
+        out << ' ';
+    }
+    return out.str();
+}
+
+template<typename F>
+void report(const char *name, int n, size_t bytes, F body) {
+    auto start = steady_clock::now();
+    double sum = body();
+    double secs = duration<double>(steady_clock::now() - start).count();
+    cout << name << ": " << (secs * 1e9 / n) << " ns/literal, "
+         << (bytes / secs / 1e6) << " MB/s (checksum " << sum << ")" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    GC_INIT();
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    string corpus = make_corpus(n);
+
+    report("legacy istream", n, corpus.size(), [&]() {
+        istringstream in(corpus);
+        double sum = 0;
+        for (int i = 0; i < n; ++i) {
+            while (is_whitespace(in.peek())) in.get();
+            sum += double_val(cast<Number>(legacy_read_number(in)));
+        }
+        return sum;
+    });
+
+    report("Reader::read_number", n, corpus.size(), [&]() {
+        Reader reader(corpus);
+        double sum = 0;
+        while (! reader.at_end())
+            sum += double_val(cast<Number>(reader.read_number()));
+        return sum;
+    });
+
+    report("scan_number", n, corpus.size(), [&]() {
+        const char *p = corpus.data(), *end = p + corpus.size();
+        double sum = 0;
+        NumberLiteral lit;
+        while (p < end) {
+            const char *tok = p;
+            while (*p != ' ') ++p;
+            scan_number(tok, p++, lit);
+            sum += lit.kind == NumberLiteral::NL_Int ? lit.l : lit.d;
+        }
+        return sum;
+    });
+
+    return 0;
+}
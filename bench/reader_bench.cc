@@ -0,0 +1,221 @@
+// Reader throughput over synthetic corpora. Each corpus is generated from a
+// fixed seed, so runs are comparable across reader changes. Each corpus is
+// timed through the text reader and again through a binary image of the
+// same forms. Results are printed one JSON object per line:
+//
+//   ./reader_bench [megabytes] [corpus ...]
+//   ./reader_bench --dump DIR [megabytes]     writes DIR/<corpus>.lisp
+#include "lisp.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+using namespace std::chrono;
+
+// Counts C++ heap allocations (vector growth, strings, the old stringstream
+// path). Forms themselves come from the GC and are tracked in bytes.
+static size_t heap_allocs = 0;
+
+void *operator new(size_t size) {
+    ++heap_allocs;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+
+class Corpus {
+protected:
+    mt19937 rng;
+    ostringstream out;
+
+    unsigned pick(unsigned n) { return rng() % n; }
+
+    void symbol() {
+        static const char *stems[] = { "foo", "bar", "list", "map", "reduce", "acc", "x", "y", "node", "vertex" };
+        out << stems[pick(10)];
+        if (pick(2))
+            out << '-' << pick(100);
+    }
+    void number() {
+        switch (pick(4)) {
+        case 0: out << pick(1000); break;
+        case 1: out << '-' << pick(1000000); break;
+        case 2: out << "0x" << hex << rng() << dec; break;
+        case 3: out << pick(1000) << '.' << pick(1000); break;
+        }
+    }
+
+public:
+    Corpus() : rng(20140101) {}
+    virtual ~Corpus() {}
+    virtual const char *name() = 0;
+    virtual void form() = 0;
+
+    string generate(size_t bytes) {
+        while ((size_t)out.tellp() < bytes) {
+            form();
+            out << '\n';
+        }
+        return out.str();
+    }
+};
+
+// A few very long flat lists.
+class FlatCorpus : public Corpus {
+public:
+    const char *name() { return "flat"; }
+    void form() {
+        out << '(';
+        for (int i = 0; i < 100000; ++i) {
+            if (pick(2)) number(); else symbol();
+            out << ' ';
+        }
+        out << ')';
+    }
+};
+
+// Lists nested a thousand deep.
+class DeepCorpus : public Corpus {
+public:
+    const char *name() { return "deep"; }
+    void form() {
+        for (int i = 0; i < 1000; ++i) {
+            out << '(';
+            symbol();
+            out << ' ';
+        }
+        out << string(1000, ')');
+    }
+};
+
+// Code-shaped forms: mostly symbols, modest nesting.
+class SymbolCorpus : public Corpus {
+    void expr(int depth) {
+        if (depth == 0 || pick(3) == 0) {
+            symbol();
+            return;
+        }
+        out << '(';
+        symbol();
+        for (unsigned i = 0, n = 1 + pick(4); i < n; ++i) {
+            out << ' ';
+            expr(depth - 1);
+        }
+        out << ')';
+    }
+public:
+    const char *name() { return "symbols"; }
+    void form() {
+        out << "(def ";
+        symbol();
+        out << " (fn (x y) ";
+        expr(6);
+        out << "))";
+    }
+};
+
+// Data rows of numbers.
+class NumberCorpus : public Corpus {
+public:
+    const char *name() { return "numbers"; }
+    void form() {
+        out << '(';
+        for (int i = 0; i < 16; ++i) {
+            number();
+            out << ", ";
+        }
+        out << ')';
+    }
+};
+
+// Quoted data with quotes inside.
+class QuoteCorpus : public Corpus {
+public:
+    const char *name() { return "quotes"; }
+    void form() {
+        out << "'(";
+        for (int i = 0; i < 8; ++i) {
+            out << (pick(2) ? "'" : "''");
+            if (pick(2)) symbol(); else { out << "("; symbol(); out << " . "; number(); out << ")"; }
+            out << ' ';
+        }
+        out << ')';
+    }
+};
+
+void report(const char *corpus, const char *reader, size_t bytes, size_t forms,
+            double secs, size_t gc_bytes, size_t allocs) {
+    printf("{\"corpus\": \"%s\", \"reader\": \"%s\", \"bytes\": %zu, \"forms\": %zu, "
+           "\"seconds\": %.6f, \"mb_per_sec\": %.2f, \"forms_per_sec\": %.1f, "
+           "\"gc_bytes_per_form\": %.1f, \"heap_allocs_per_form\": %.3f}\n",
+           corpus, reader, bytes, forms, secs, bytes / secs / 1e6, forms / secs,
+           (double)gc_bytes / forms, (double)allocs / forms);
+}
+
+void run(Corpus &corpus, size_t bytes) {
+    string src = corpus.generate(bytes);
+    FormVector forms;
+
+    size_t gc_before = GC_get_total_bytes();
+    size_t allocs_before = heap_allocs;
+    auto start = steady_clock::now();
+
+    Reader reader(src);
+    while (! reader.at_end())
+        forms.push_back(reader.read_form());
+
+    double secs = duration<double>(steady_clock::now() - start).count();
+    report(corpus.name(), "text", src.size(), forms.size(), secs,
+           GC_get_total_bytes() - gc_before, heap_allocs - allocs_before);
+
+    // The same forms again, loaded from a binary image.
+    string image = print_binary(forms);
+    gc_before = GC_get_total_bytes();
+    allocs_before = heap_allocs;
+    start = steady_clock::now();
+
+    FormVector loaded = read_binary(image.data(), image.data() + image.size());
+
+    secs = duration<double>(steady_clock::now() - start).count();
+    report(corpus.name(), "binary", image.size(), loaded.size(), secs,
+           GC_get_total_bytes() - gc_before, heap_allocs - allocs_before);
+}
+
+int main(int argc, char *argv[]) {
+    GC_INIT();
+
+    const char *dump_dir = nullptr;
+    if (argc > 2 && strcmp(argv[1], "--dump") == 0) {
+        dump_dir = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    size_t bytes = (argc > 1 ? atof(argv[1]) : 8) * 1024 * 1024;
+
+    FlatCorpus flat;
+    DeepCorpus deep;
+    SymbolCorpus symbols;
+    NumberCorpus numbers;
+    QuoteCorpus quotes;
+    Corpus *all[] = { &flat, &deep, &symbols, &numbers, &quotes };
+
+    for (Corpus *c : all) {
+        bool wanted = argc <= 2;
+        for (int i = 2; i < argc; ++i)
+            wanted |= strcmp(argv[i], c->name()) == 0;
+        if (! wanted)
+            continue;
+
+        if (dump_dir) {
+            ofstream(string(dump_dir) + "/" + c->name() + ".lisp") << c->generate(bytes);
+            continue;
+        }
+        run(*c, bytes);
+    }
+    return 0;
+}
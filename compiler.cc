@@ -1,18 +1,381 @@
 #include "compiler.h"
+#include "llvm/IR/Intrinsics.h"
+
+#include <cstring>
 #include <sstream>
 
 NilExpr *const NIL_EXPR = new NilExpr();
 
-EnvMap GLOBAL_DEFS;
+SymbolMap<Value*> GLOBAL_DEFS;
 EnvList LOCALS;
+vector<TypeMap> LOCAL_TYPES;
+vector<RecurFrame> RECUR_FRAMES;
+
+// What a recur being parsed would jump to: the innermost loop, or fn when
+// loop is null.
+struct RecurTarget {
+    LoopExpr *loop;
+    FnExpr *fn;
+    size_t arity;
+};
+static vector<RecurTarget> RECUR_TARGETS;
+
+bool DUMP_IR = false;
+int TRACE_LEVEL = 0;
+
+// Forms that compiled code refers to by address, per function. The lists
+// are traceable (uncollectable, and scanned), so a constant lives exactly
+// as long as some function that embeds it.
+typedef vector<Form*, traceable_allocator<Form*> > RootList;
+static unordered_map<Function*, RootList> CONSTANT_ROOTS;
+
+Value *form_ptr(Form *f, IRBuilder<> &builder) {
+    if (f && ! is_immediate(f))
+        CONSTANT_ROOTS[builder.GetInsertBlock()->getParent()].push_back(f);
 
-Value *form_ptr(Form *f) {
     Constant *form_addr = ConstantInt::get(getGlobalContext(), APInt(64, (intptr_t) f));
     return ConstantExpr::getIntToPtr(form_addr, TypeBuilder<void*,false>::get(getGlobalContext()));
 }
 
+void free_function(Function *f, ExecutionEngine *ee) {
+    if (ee)
+        ee->freeMachineCodeForFunction(f);
+    CONSTANT_ROOTS.erase(f);
+    f->eraseFromParent();
+}
+
+void drop_functions_after(Module *mod, size_t n) {
+    vector<Function*> dropped;
+    auto fi = mod->begin();
+    advance(fi, n);
+    for (; fi != mod->end(); ++fi)
+        dropped.push_back(&*fi);
+    // Uncalled first, so they can go in any order.
+    for (Function *f : dropped)
+        f->dropAllReferences();
+    for (Function *f : dropped)
+        free_function(f, nullptr);
+}
+
+// Storage for def'd globals: one uncollectable word per symbol, so the
+// collector sees what it holds. Compiled code loads and stores the cell at
+// its fixed address.
+static Value *global_cell(Symbol *s) {
+    static SymbolMap<Form**> cells;
+    Form **&cell = cells[s];
+    if (! cell) {
+        cell = (Form **)GC_MALLOC_UNCOLLECTABLE(sizeof(Form*));
+        if (! cell)
+            throw bad_alloc();
+    }
+
+    Constant *cell_addr = ConstantInt::get(getGlobalContext(), APInt(64, (intptr_t) cell));
+    return ConstantExpr::getIntToPtr(cell_addr, TypeBuilder<void**,false>::get(getGlobalContext()));
+}
+
+Value *form_word(IRBuilder<> &builder, Value *form) {
+    return builder.CreatePtrToInt(form, Type::getInt64Ty(getGlobalContext()));
+}
+
+Value *emit_is_fixnum(IRBuilder<> &builder, Value *form) {
+    Value *tag = builder.CreateAnd(form_word(builder, form), FIXNUM_TAG);
+    return builder.CreateICmpNE(tag, ConstantInt::get(tag->getType(), 0), "is_fixnum");
+}
+
+Value *emit_fixnum_val(IRBuilder<> &builder, Value *form) {
+    return builder.CreateAShr(form_word(builder, form), 1, "fixnum");
+}
+
+// No range check: i must already fit in 63 bits.
+Value *emit_make_fixnum(IRBuilder<> &builder, Value *i) {
+    Value *word = builder.CreateOr(builder.CreateShl(i, 1), FIXNUM_TAG);
+    return builder.CreateIntToPtr(word, TypeBuilder<void*,false>::get(getGlobalContext()));
+}
+
+Value *emit_is_flonum(IRBuilder<> &builder, Value *form) {
+    Value *tag = builder.CreateAnd(form_word(builder, form), IMMEDIATE_MASK);
+    return builder.CreateICmpEQ(tag, ConstantInt::get(tag->getType(), FLONUM_TAG), "is_flonum");
+}
+
+// The inline halves of flonum_val and flonum_word/flonum_fits in lisp.h.
+Value *emit_flonum_val(IRBuilder<> &builder, Value *form) {
+    Value *w = form_word(builder, form);
+    Type *word = w->getType();
+    Value *low = builder.CreateSub(ConstantInt::get(word, 2), builder.CreateLShr(w, 63));
+    Value *t = builder.CreateOr(builder.CreateAnd(w, ~IMMEDIATE_MASK), low);
+    Value *bits = builder.CreateOr(builder.CreateLShr(t, 3), builder.CreateShl(t, 61));
+    bits = builder.CreateSelect(builder.CreateICmpEQ(w, ConstantInt::get(word, FLONUM_ZERO)),
+                                ConstantInt::get(word, 0), bits);
+    return builder.CreateBitCast(bits, Type::getDoubleTy(getGlobalContext()), "flonum");
+}
+
+// bits is a double as an i64; fits is set to whether the result is valid.
+Value *emit_make_flonum(IRBuilder<> &builder, Value *bits, Value *&fits) {
+    Type *word = bits->getType();
+    Value *zero = ConstantInt::get(word, 0);
+    Value *top = builder.CreateAnd(builder.CreateLShr(bits, 60), 7);
+    fits = builder.CreateOr(
+        builder.CreateICmpEQ(bits, zero),
+        builder.CreateAnd(builder.CreateICmpNE(bits, ConstantInt::get(word, 0x3000000000000000ULL)),
+                          builder.CreateICmpULE(builder.CreateSub(top, ConstantInt::get(word, 3)),
+                                                ConstantInt::get(word, 1))),
+        "fits_flonum");
+    Value *rot = builder.CreateOr(builder.CreateShl(bits, 3), builder.CreateLShr(bits, 61));
+    Value *w = builder.CreateOr(builder.CreateAnd(rot, ~IMMEDIATE_MASK), FLONUM_TAG);
+    w = builder.CreateSelect(builder.CreateICmpEQ(bits, zero), ConstantInt::get(word, FLONUM_ZERO), w);
+    return builder.CreateIntToPtr(w, TypeBuilder<void*,false>::get(getGlobalContext()));
+}
+
+// Declares a runtime function for emitted code to call. The JIT resolves
+// it by name in the running binary.
+static Function *runtime_fn(Module *mod, const char *name, Type *ret, vector<Type*> args) {
+    if (Function *f = mod->getFunction(name))
+        return f;
+    return Function::Create(FunctionType::get(ret, args, false),
+                            Function::ExternalLinkage, name, mod);
+}
+
+// The frame of the function being emitted, under any loops in it.
+static RecurFrame &fn_frame() {
+    auto frame = RECUR_FRAMES.rbegin();
+    while (! frame->fn)
+        ++frame;
+    return *frame;
+}
+
+// After a call that may have held an error (see error_pending): if it did,
+// return from the function being emitted, which the caller checks in turn,
+// with a dummy value nothing will use. The builder is left on the path
+// where there was none.
+static void emit_error_check(IRBuilder<> &builder) {
+    LLVMContext &c = getGlobalContext();
+    RecurFrame &frame = fn_frame();
+    Function *f = frame.fn;
+    if (! frame.unwind) {
+        frame.unwind = BasicBlock::Create(c, "unwind", f);
+        IRBuilder<>(frame.unwind).CreateRet(Constant::getNullValue(f->getReturnType()));
+    }
+
+    Constant *flag_addr = ConstantInt::get(c, APInt(64, (intptr_t) &error_pending));
+    Value *flag = builder.CreateLoad(ConstantExpr::getIntToPtr(flag_addr, Type::getInt8PtrTy(c)), "error_pending");
+    BasicBlock *ok_bb = BasicBlock::Create(c, "no_error", f);
+    builder.CreateCondBr(builder.CreateIsNotNull(flag), frame.unwind, ok_bb);
+    builder.SetInsertPoint(ok_bb);
+}
+
+static Value *emit_checked_call(IRBuilder<> &builder, Function *callee, ArrayRef<Value*> args) {
+    Value *res = builder.CreateCall(callee, args);
+    emit_error_check(builder);
+    return res;
+}
+
+// The thread's free lists, fetched by a call at the top of the function
+// being emitted and shared by every allocation in it.
+static Value *emit_free_lists(IRBuilder<> &builder, Module *mod) {
+    Type *ptr_ptr = TypeBuilder<void**,false>::get(getGlobalContext());
+    Function *lists_fn = runtime_fn(mod, "small_alloc_lists", ptr_ptr, {});
+
+    BasicBlock &entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+    for (Instruction &inst : entry)
+        if (CallInst *ci = dyn_cast<CallInst>(&inst))
+            if (ci->getCalledFunction() == lists_fn)
+                return ci;
+
+    IRBuilder<> top(&entry, entry.begin());
+    return top.CreateCall(lists_fn, "free_lists");
+}
+
+Value *emit_small_alloc(IRBuilder<> &builder, Module *mod, size_t size) {
+    LLVMContext &ctx = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(ctx);
+    Type *ptr_ptr = TypeBuilder<void**,false>::get(ctx);
+    Type *word = Type::getInt64Ty(ctx);
+    size_t cls = (size + SMALL_GRANULE - 1) / SMALL_GRANULE;
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *pop_bb = BasicBlock::Create(ctx, "alloc_pop", f);
+    BasicBlock *refill_bb = BasicBlock::Create(ctx, "alloc_refill", f);
+    BasicBlock *done_bb = BasicBlock::Create(ctx, "alloc_done", f);
+
+    Value *head_ptr = builder.CreateConstGEP1_64(emit_free_lists(builder, mod), cls);
+    Value *head = builder.CreateLoad(head_ptr, "head");
+    builder.CreateCondBr(builder.CreateIsNull(head), refill_bb, pop_bb);
+
+    builder.SetInsertPoint(pop_bb);
+    Value *link = builder.CreateBitCast(head, ptr_ptr);
+    builder.CreateStore(builder.CreateLoad(link), head_ptr);
+    builder.CreateStore(ConstantPointerNull::get(cast<PointerType>(ptr)), link);
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(refill_bb);
+    Function *refill_fn = runtime_fn(mod, "small_alloc_jit_refill", ptr, {word});
+    Value *fresh = emit_checked_call(builder, refill_fn, ConstantInt::get(word, cls));
+    refill_bb = builder.GetInsertBlock();
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(done_bb);
+    PHINode *mem = builder.CreatePHI(ptr, 2, "mem");
+    mem->addIncoming(head, pop_bb);
+    mem->addIncoming(fresh, refill_bb);
+    return mem;
+}
+
+// Lays out a Pair by hand: the kind in the first word (zeroing the padding
+// after it), then car and cdr.
+Value *emit_cons(IRBuilder<> &builder, Module *mod, Value *car, Value *cdr) {
+    LLVMContext &ctx = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(ctx);
+    Type *word = Type::getInt64Ty(ctx);
+
+    Value *mem = emit_small_alloc(builder, mod, sizeof(Pair));
+    Value *words = builder.CreateBitCast(mem, word->getPointerTo());
+    builder.CreateStore(ConstantInt::get(word, Form::FK_Pair), words);
+    Value *slots = builder.CreateBitCast(mem, ptr->getPointerTo());
+    builder.CreateStore(builder.CreatePointerCast(car, ptr), builder.CreateConstGEP1_64(slots, 1));
+    builder.CreateStore(builder.CreatePointerCast(cdr, ptr), builder.CreateConstGEP1_64(slots, 2));
+    return mem;
+}
+
+// Boxes an unboxed value of type t: inline when it fits an immediate,
+// otherwise by the runtime's box_long or box_double.
+Value *emit_box(IRBuilder<> &builder, Module *mod, Value *v, ValType t) {
+    if (! is_unboxed(t))
+        return v;
+
+    LLVMContext &c = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(c);
+    Type *word = Type::getInt64Ty(c);
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *slow_bb = BasicBlock::Create(c, "box_slow", f);
+    BasicBlock *done_bb = BasicBlock::Create(c, "box_done", f);
+
+    Value *fits, *imm;
+    if (t == T_INT) {
+        fits = builder.CreateICmpEQ(builder.CreateAShr(builder.CreateShl(v, 1), 1), v);
+        imm = emit_make_fixnum(builder, v);
+    } else {
+        imm = emit_make_flonum(builder, builder.CreateBitCast(v, word), fits);
+    }
+    BasicBlock *imm_bb = builder.GetInsertBlock();
+    builder.CreateCondBr(fits, done_bb, slow_bb);
+
+    builder.SetInsertPoint(slow_bb);
+    Function *box_fn = runtime_fn(mod, t == T_INT ? "box_long" : "box_double", ptr, {v->getType()});
+    Value *boxed = emit_checked_call(builder, box_fn, v);
+    slow_bb = builder.GetInsertBlock();
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(done_bb);
+    PHINode *res = builder.CreatePHI(ptr, 2, "boxed");
+    res->addIncoming(imm, imm_bb);
+    res->addIncoming(boxed, slow_bb);
+    return res;
+}
+
+// The other way, for a boxed value that inference found is always of type
+// t. Rare, so always by the runtime, which also checks.
+static Value *emit_unbox(IRBuilder<> &builder, Module *mod, Value *v, ValType t) {
+    Type *ptr = TypeBuilder<void*,false>::get(getGlobalContext());
+    Function *unbox_fn = runtime_fn(mod, t == T_INT ? "unbox_long" : "unbox_double", native_type(t), {ptr});
+    return emit_checked_call(builder, unbox_fn, builder.CreatePointerCast(v, ptr));
+}
+
+Value *Expr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    return emit_unbox(builder, mod, emit(ctx, mod, builder), _type);
+}
+
+Value *Expr::emit_test(Module *mod, IRBuilder<> &builder) {
+    // Numbers are never nil.
+    if (is_unboxed(_type)) {
+        emit_unboxed(C_EXPRESSION, mod, builder);
+        return builder.getTrue();
+    }
+    Value *v = emit(C_EXPRESSION, mod, builder);
+    return builder.CreateIsNotNull(builder.CreatePointerCast(v, native_type(T_ANY)));
+}
+
+Value *Expr::emit_as(ValType want, Module *mod, IRBuilder<> &builder, Expr::Context ctx) {
+    // Control never comes back from a T_NONE (such as recur) with a value.
+    if (_type == T_NONE && is_unboxed(want)) {
+        emit(ctx, mod, builder);
+        return UndefValue::get(native_type(want));
+    }
+    if (! is_unboxed(want))
+        return emit(ctx, mod, builder);
+    if (_type == want)
+        return emit_unboxed(ctx, mod, builder);
+    if (_type == T_INT && want == T_DOUBLE)
+        return builder.CreateSIToFP(emit_unboxed(ctx, mod, builder), native_type(T_DOUBLE));
+    return emit_unbox(builder, mod, emit(ctx, mod, builder), want);
+}
+
+// Code after a jump or return that ends a tail call is never reached, but
+// the expression it replaced still has to give a value: it goes in a block
+// of its own with no way in, which the optimizer drops.
+static Value *emit_after_tail(IRBuilder<> &builder, Type *t) {
+    Function *f = builder.GetInsertBlock()->getParent();
+    builder.SetInsertPoint(BasicBlock::Create(getGlobalContext(), "after_tail", f));
+    return UndefValue::get(t);
+}
+
+// Feeds args to frame's phis from the current block and jumps to it.
+static void emit_jump(IRBuilder<> &builder, RecurFrame &frame, vector<Value*> &args) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        Value *v = args[i];
+        if (v->getType() != frame.phis[i]->getType() && v->getType()->isPointerTy())
+            v = builder.CreatePointerCast(v, frame.phis[i]->getType());
+        frame.phis[i]->addIncoming(v, builder.GetInsertBlock());
+    }
+    builder.CreateBr(frame.header);
+}
+
+// A call in the function's tail (ctx C_RETURN in a frame that is tail) to
+// the function being emitted is a jump back to the top of it with the
+// arguments fed to its phis. Any other such call between fastcc functions
+// returning the same type is marked tail and returned straight away, which
+// GuaranteedTailCallOpt (set on the engine) turns into a jump that reuses
+// the caller's frame. Its result goes back to our own caller, which checks
+// it for an error; every other call is checked here.
+static Value *emit_call(IRBuilder<> &builder, Function *callee, vector<Value*> &args, Expr::Context ctx) {
+    Function *caller = builder.GetInsertBlock()->getParent();
+    bool tail = ctx == Expr::C_RETURN && ! RECUR_FRAMES.empty() && RECUR_FRAMES.back().tail;
+    if (tail) {
+        // Loops in the function's tail are between it and the call.
+        RecurFrame &frame = fn_frame();
+        if (frame.fn == callee) {
+            emit_jump(builder, frame, args);
+            return emit_after_tail(builder, callee->getReturnType());
+        }
+    }
+
+    CallInst *call = builder.CreateCall(callee, args);
+    call->setCallingConv(callee->getCallingConv());
+    if (tail && callee->getCallingConv() == CallingConv::Fast
+        && caller->getCallingConv() == CallingConv::Fast
+        && callee->getReturnType() == caller->getReturnType()) {
+        call->setTailCall();
+        builder.CreateRet(call);
+        return emit_after_tail(builder, call->getType());
+    }
+    emit_error_check(builder);
+    return call;
+}
+
+// Calls each(elem, i) on the elements of lis after its head, in the same
+// walk that checks it is a proper list. Returns how many there were.
+template<typename F>
+static size_t each_arg(Pair *lis, const char *what, F each) {
+    size_t n = 0;
+    Form *rest = lis->cdr();
+    for (Pair *p; (p = dyn_cast_or_null<Pair>(rest)); rest = p->cdr())
+        each(p->car(), n++);
+    if (rest)
+        throw CompileError(string(what) + " must be a proper list");
+    return n;
+}
+
 Expr *Expr::parse(Form *f) {
-    // cerr << "Expr::parse - " << print_form(f) << endl;
     if (! f) return NIL_EXPR;
     if (Pair *p = dyn_cast<Pair>(f)) {
         if (Symbol *s = dyn_cast<Symbol>(p->car())) {
@@ -20,9 +383,17 @@ Expr *Expr::parse(Form *f) {
             if (s == Symbol::FN) return FnExpr::parse(p);
             if (s == Symbol::QUOTE) return QuoteExpr::parse(p);
             if (s == Symbol::DO) return DoExpr::parse(p);
+            if (s == Symbol::IF) return IfExpr::parse(p);
+            if (s == Symbol::LOOP) return LoopExpr::parse(p);
+            if (s == Symbol::RECUR) return RecurExpr::parse(p);
+            if (const Builtin *b = find_builtin(s)) return BuiltinExpr::parse(p, b);
         }
         return InvokeExpr::parse(p);
     }
+    if (Vector *v = dyn_cast<Vector>(f))
+        return VectorExpr::parse(v);
+    if (String *s = dyn_cast<String>(f))
+        return StringExpr::parse(s);
     if (Number *n = dyn_cast<Number>(f))
         return NumberExpr::parse(n);
     if (Symbol *s = dyn_cast<Symbol>(f))
@@ -32,48 +403,45 @@ Expr *Expr::parse(Form *f) {
 }
 
 DefExpr *DefExpr::parse(Pair *lis) {
-    cerr << "DefExpr::parse - " << print_form(lis) << endl;
-    if (! lis->cdr())
-        throw CompileError("def requires an argument");
-    if (! listp(lis->cdr()))
-        throw CompileError("def must be a proper list");
-    Pair *bind_pair = cast<Pair>(lis->cdr());
-    if (! isa<Symbol>(bind_pair->car()))
-        throw CompileError("def must bind to a symbol");
-    if (count(lis) > 3)
-        throw CompileError("def takes at most one binding value");
-    
+    TRACE(2, "DefExpr::parse - " << print_form(lis));
+
     DefExpr *de = new DefExpr(lis);
-    de->_name = cast<Symbol>(bind_pair->car());
-    if (Pair *valp = dyn_cast_or_null<Pair>(bind_pair->cdr()))
-        de->_value = Expr::parse(valp->car());
+    de->_value = NIL_EXPR;
+    size_t n = each_arg(lis, "def", [&](Form *arg, size_t i) {
+        if (i == 0) {
+            if (! (de->_name = dyn_cast_or_null<Symbol>(arg)))
+                throw CompileError("def must bind to a symbol");
+        } else if (i == 1) {
+            de->_value = Expr::parse(arg);
+        } else {
+            throw CompileError("def takes at most one binding value");
+        }
+    });
+    if (! n)
+        throw CompileError("def requires an argument");
 
-    GLOBAL_DEFS.insert(EnvElem(de->_name, nullptr));
+    GLOBAL_DEFS.insert(de->_name, nullptr);
     
     return de;
 }
 
-Value *DefExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
-    Constant *gv = mod->getNamedValue(_name->name());
+ValType DefExpr::infer() {
+    _value->infer();
+    return _type = T_ANY;
+}
 
+Value *DefExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
     Value *bind_value = _value->emit(C_EXPRESSION, mod, builder);
-    if (!gv)
-        gv = new GlobalVariable(*mod,
-                                bind_value->getType(),
-                                false,
-                                GlobalValue::ExternalLinkage,
-                                // value is purely external without init
-                                Constant::getNullValue(bind_value->getType()),
-                                _name->name());
-
-    GLOBAL_DEFS[_name] = gv;
-    builder.CreateStore(bind_value, gv);
+    Value *cell = global_cell(_name);
+
+    GLOBAL_DEFS[_name] = cell;
+    builder.CreateStore(builder.CreatePointerCast(bind_value, TypeBuilder<void*,false>::get(getGlobalContext())), cell);
     return bind_value;
 }
 
 FnExpr *FnExpr::parse(Pair *lis) {
-    cerr << "FnExpr::parse - " << print_form(lis) << endl;
-        
+    TRACE(2, "FnExpr::parse - " << print_form(lis));
+
     Pair *body = dyn_cast_or_null<Pair>(lis->cdr());
     if (! body)
         throw CompileError("Invalid fn definition");
@@ -90,113 +458,265 @@ FnExpr *FnExpr::parse(Pair *lis) {
         
     if (! body)
         throw CompileError("Invalid fn definition");
-    if (! listp(body->car()))
-        throw CompileError("Function arguments must be a list");
-    if (! listp(body->cdr()))
-        throw CompileError("Function definition must be a proper list");
-
-    Pair *loa = cast_or_null<Pair>(body->car());
-    Symbol *a;
 
-    while(loa) {
-        a = dyn_cast_or_null<Symbol>(loa->car());
+    Form *args = body->car();
+    for (Pair *p; (p = dyn_cast_or_null<Pair>(args)); args = p->cdr()) {
+        Symbol *a = dyn_cast_or_null<Symbol>(p->car());
         if (!a) throw CompileError("Function args must be symbols");
         fe->_arglist.push_back(a);
         env[a] = nullptr;
-        loa = dyn_cast_or_null<Pair>(loa->cdr());
     }
-    
+    if (args)
+        throw CompileError("Function arguments must be a list");
+
+    // In scope for the body's parse only; each emit binds them afresh.
     LOCALS.push_back(env);
-    fe->_env_i = LOCALS.rbegin();
-    
-    Pair *body_forms = cast_or_null<Pair>(body->cdr());
-    fe->_body = Expr::parse(cons(Symbol::DO, body_forms));
+    RECUR_TARGETS.push_back(RecurTarget { nullptr, fe, fe->_arglist.size() });
+    try {
+        // The body's shape is checked as the do is parsed.
+        fe->_body = DoExpr::parse(cons(Symbol::DO, body->cdr()), "Function definition");
+    } catch (...) {
+        RECUR_TARGETS.pop_back();
+        LOCALS.pop_back();
+        throw;
+    }
+    RECUR_TARGETS.pop_back();
+    LOCALS.pop_back();
 
     return fe;
 }
 
-Value *FnExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
-    FunctionType *ft = FunctionType::get(
-        TypeBuilder<void*,false>::get(getGlobalContext()),
-        vector<Type*>(_arglist.size(), TypeBuilder<void*,false>::get(getGlobalContext())),
-        false);
-    
-    Function *f = Function::Create(ft, Function::ExternalLinkage, "", mod);
+Type *native_type(ValType t) {
+    if (t == T_INT) return Type::getInt64Ty(getGlobalContext());
+    if (t == T_DOUBLE) return Type::getDoubleTy(getGlobalContext());
+    return TypeBuilder<void*,false>::get(getGlobalContext());
+}
+
+// Infers the body with the arguments typed for one entry point, returning
+// the body's type. A recursive call to the same entry point sees the
+// result type assumed so far, starting from T_NONE, and the body is
+// inferred again until the two agree.
+static FnExpr *INFERRING = nullptr;   // the innermost body being inferred
+
+// Marks a body busy while it is inferred or emitted, and puts the scope
+// stacks and INFERRING back as they were when it is done, however that
+// happens: an error part way through also drops whatever loops and bodies
+// nested in it had pushed.
+class BodyScope {
+    unsigned &_busy;
+    size_t _locals, _local_types, _recur_frames;
+    FnExpr *_inferring;
+
+public:
+    BodyScope(unsigned &busy)
+        : _busy(busy), _locals(LOCALS.size()), _local_types(LOCAL_TYPES.size()),
+          _recur_frames(RECUR_FRAMES.size()), _inferring(INFERRING) {
+        ++_busy;
+    }
+
+    ~BodyScope() {
+        --_busy;
+        LOCALS.resize(_locals);
+        LOCAL_TYPES.resize(_local_types);
+        RECUR_FRAMES.resize(_recur_frames);
+        INFERRING = _inferring;
+    }
+};
+
+ValType FnExpr::infer_body(const vector<ValType> &types) {
+    TypeMap scope;
     if (_name)
-        (*_env_i)[_name] = f;
+        scope[_name] = LocalType { T_ANY, this };
+    for (size_t i = 0; i < _arglist.size(); ++i)
+        scope[_arglist[i]] = LocalType { types[i], nullptr };
+
+    ValType ret;
+    {
+        BodyScope body_scope(_busy);
+        LOCAL_TYPES.push_back(scope);
+        INFERRING = this;
+        Spec &spec = _specs[types];
+        ret = _body->infer();
+        for (int tries = 0; ret != spec.ret && tries < 3; ++tries) {
+            spec.ret = ret;
+            ret = _body->infer();
+        }
+        if (ret != spec.ret)
+            ret = T_ANY;
+    }
+
+    // Only a call to itself, with no way out, is still unknown.
+    return ret == T_NONE ? T_ANY : ret;
+}
+
+// Fills in f, the entry point for arguments of types returning ret.
+void FnExpr::emit_body(Function *f, const vector<ValType> &types, ValType ret,
+                       Module *mod, IRBuilder<> &builder) {
+    EnvMap env;
+    TypeMap scope;
+    if (_name) {
+        env[_name] = _generic;
+        scope[_name] = LocalType { T_ANY, this };
+    }
 
+    // The entry block is left holding allocas and other once-per-call
+    // setup; the body starts after it, where tail calls come back to.
     BasicBlock *bb = BasicBlock::Create(getGlobalContext(), "entry", f);
+    BasicBlock *top_bb = BasicBlock::Create(getGlobalContext(), "top", f);
 
     auto savedIP = builder.saveIP();
-    builder.SetInsertPoint(bb);
-
-    auto ai = _arglist.begin();
-    for (auto func_ai = f->arg_begin();
-         func_ai != f->arg_end() && ai != _arglist.end();
-         ++func_ai, ++ai)
     {
-        func_ai->setName((*ai)->name());
-        (*_env_i)[*ai] = func_ai;
+        BodyScope body_scope(_busy);
+        builder.SetInsertPoint(bb);
+        builder.CreateBr(top_bb);
+        builder.SetInsertPoint(top_bb);
+
+        RecurFrame frame { f, top_bb, {}, types, true, nullptr };
+        size_t i = 0;
+        for (auto func_ai = f->arg_begin(); func_ai != f->arg_end(); ++func_ai, ++i) {
+            func_ai->setName(_arglist[i]->name());
+            PHINode *phi = builder.CreatePHI(func_ai->getType(), 2, _arglist[i]->name());
+            phi->addIncoming(func_ai, bb);
+            frame.phis.push_back(phi);
+            env[_arglist[i]] = phi;
+            scope[_arglist[i]] = LocalType { types[i], nullptr };
+        }
+
+        RECUR_FRAMES.push_back(frame);
+        LOCALS.push_back(env);
+        LOCAL_TYPES.push_back(scope);
+        FnExpr *outer = INFERRING;
+        INFERRING = this;
+        try {
+            _body->infer();
+            INFERRING = outer;
+            Value *ret_val = _body->emit_as(ret, mod, builder, C_RETURN);
+            TRACE(3, "FnExpr::emit - returning " << (void*)ret_val);
+            if (ret == T_ANY)
+                ret_val = builder.CreatePointerCast(ret_val, native_type(T_ANY));
+            builder.CreateRet(ret_val);
+        } catch (...) {
+            // The whole top-level form fails, and compile_toplevel drops
+            // every function made for it, f and its callers included.
+            for (auto &types : _deferred)
+                _specs.erase(types);
+            _deferred.clear();
+            throw;
+        }
     }
 
-    try {
-        Value *ret = _body->emit(C_EXPRESSION, mod, builder);
-        // cerr << "Fn ret: ";
-        // ret->dump();
+    if (DUMP_IR)
+        f->dump();
 
-        Value *cast_ret = builder.CreatePointerCast(ret, TypeBuilder<void*,false>::get(getGlobalContext()));
-        builder.CreateRet(cast_ret);
+    verifyFunction(*f);
+    optimize_function(f);
 
-        LOCALS.pop_back();
+    builder.restoreIP(savedIP);
 
-        f->dump();
-        // mod->dump();
+    // The body's types are free again.
+    while (! _busy && ! _deferred.empty()) {
+        vector<ValType> next = _deferred.back();
+        _deferred.pop_back();
+        Spec &spec = _specs[next];
+        try {
+            emit_body(spec.fn, next, spec.ret, mod, builder);
+        } catch (...) {
+            _specs.erase(next);
+            throw;
+        }
+    }
+}
 
-        verifyFunction(*f);
-        // TODO: Optimization passes
+Value *FnExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    return emit_generic(CallingConv::Fast, mod, builder);
+}
 
-        builder.restoreIP(savedIP);
-        return f;
+Function *FnExpr::emit_generic(CallingConv::ID cc, Module *mod, IRBuilder<> &builder) {
+    FunctionType *ft = FunctionType::get(
+        native_type(T_ANY), vector<Type*>(_arglist.size(), native_type(T_ANY)), false);
+    
+    _generic = Function::Create(ft, Function::ExternalLinkage, "", mod);
+    _generic->setCallingConv(cc);
+    emit_body(_generic, vector<ValType>(_arglist.size(), T_ANY), T_ANY, mod, builder);
+    return _generic;
+}
+
+ValType FnExpr::spec_type(const vector<ValType> &types, bool &ok) {
+    // A result still being worked out is only for this body's own
+    // recursive calls; another function built on it could be left wrong.
+    auto spec = _specs.find(types);
+    if (spec != _specs.end()) {
+        ok = ! spec->second.widened && (spec->second.settled || INFERRING == this);
+        return spec->second.ret;
+    }
+
+    // Working out another entry point would retype the body under an
+    // inference or emit already using it.
+    if (_busy) {
+        ok = false;
+        return T_ANY;
+    }
+
+    _specs[types] = Spec { T_NONE, nullptr, false, false };
+    ValType ret = infer_body(types);
+    Spec &settled = _specs[types];
+    settled.ret = ret;
+    settled.settled = true;
+    ok = ! settled.widened;
+    return ret;
+}
+
+Function *FnExpr::specialize(const vector<ValType> &types, Module *mod, IRBuilder<> &builder) {
+    Spec &spec = _specs[types];
+    if (spec.fn)
+        return spec.fn;
 
-    } catch (CompileError &ce) {
-        f->eraseFromParent();
-        LOCALS.clear();
-        throw ce;
+    vector<Type*> arg_types;
+    for (ValType t : types)
+        arg_types.push_back(native_type(t));
+    FunctionType *ft = FunctionType::get(native_type(spec.ret), arg_types, false);
+
+    // Set before the body is emitted, so a recursive call finds it.
+    spec.fn = Function::Create(ft, Function::ExternalLinkage, "", mod);
+    Function *f = spec.fn;
+    f->setCallingConv(CallingConv::Fast);
+    if (_busy) {
+        _deferred.push_back(types);
+        return f;
+    }
+    try {
+        emit_body(f, types, spec.ret, mod, builder);
+    } catch (...) {
+        _specs.erase(types);
+        throw;
     }
+    return f;
 }
 
 QuoteExpr *QuoteExpr::parse(Pair *lis) {
-    cerr << "QuoteExpr::parse - " << print_form(lis) << endl;
-    if (! listp(lis))
-        throw CompileError("quote must be a proper list");
-    if (count(lis) != 2)
-        throw CompileError("quote takes exactly 1 argument");
+    TRACE(2, "QuoteExpr::parse - " << print_form(lis));
 
     QuoteExpr *qe = new QuoteExpr(lis);
-    qe->_quoted = dyn_cast<Pair>(lis->cdr())->car();
+    if (each_arg(lis, "quote", [&](Form *arg, size_t) { qe->_quoted = arg; }) != 1)
+        throw CompileError("quote takes exactly 1 argument");
     return qe;
 };
 
 Value *QuoteExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
-    return form_ptr(_quoted);
+    return form_ptr(_quoted, builder);
 }
 
-DoExpr *DoExpr::parse(Pair *lis) {
-    cerr << "DoExpr::parse - " << print_form(lis) << endl;
+DoExpr *DoExpr::parse(Pair *lis, const char *what) {
+    TRACE(2, "DoExpr::parse - " << print_form(lis));
     DoExpr *de = new DoExpr(lis);
 
-    if (! listp(lis))
-        throw CompileError("do must be a proper list");
-    if (! lis->cdr()) {
+    each_arg(lis, what, [&](Form *arg, size_t) {
+        de->_statements.push_back(Expr::parse(arg));
+    });
+    if (de->_statements.empty()) {
         de->_ret_expr = NIL_EXPR;
         return de;
     }
-
-    Pair *rest = dyn_cast<Pair>(lis->cdr());
-    while (rest) {
-        de->_statements.push_back(Expr::parse(rest->car()));
-        rest = dyn_cast_or_null<Pair>(rest->cdr());
-    }
     de->_ret_expr = de->_statements.back();
     de->_statements.pop_back();
     return de;
@@ -208,17 +728,47 @@ Value *DoExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
     return _ret_expr->emit(ctx, mod, builder);
 }
 
+ValType DoExpr::infer() {
+    for (Expr *e : _statements)
+        e->infer();
+    return _type = _ret_expr->infer();
+}
+
+Value *DoExpr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    for (Expr *e : _statements)
+        e->emit(C_STATEMENT, mod, builder);
+    return _ret_expr->emit_unboxed(ctx, mod, builder);
+}
+
 Value *NilExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
     return ConstantPointerNull::get(TypeBuilder<void*,false>::get(getGlobalContext()));
 }
 
 NumberExpr *NumberExpr::parse(Number *n) {
-    cerr << "NumberExpr::parse - " << print_form(n) << endl;
+    TRACE(2, "NumberExpr::parse - " << print_form(n));
     return new NumberExpr(n);
 }
 
 Value *NumberExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
-    return form_ptr(_form);
+    return form_ptr(_form, builder);
+}
+
+ValType NumberExpr::infer() {
+    return _type = isa<Int>(_form) ? T_INT : T_DOUBLE;
+}
+
+Value *NumberExpr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    if (_type == T_INT)
+        return ConstantInt::get(native_type(T_INT), long_val(_form));
+    return ConstantFP::get(native_type(T_DOUBLE), double_val(_form));
+}
+
+StringExpr *StringExpr::parse(String *s) {
+    return new StringExpr(s);
+}
+
+Value *StringExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    return form_ptr(_form, builder);
 }
 
 Value *resolve_local(Symbol *s) {
@@ -231,43 +781,75 @@ Value *resolve_local(Symbol *s) {
     return nullptr;
 }
 
+// At parse time locals are bound to null, so resolve_local can't tell.
+static bool is_local(Symbol *s) {
+    for (auto ri = LOCALS.rbegin(); ri != LOCALS.rend(); ri++)
+        if (ri->count(s))
+            return true;
+    return false;
+}
+
+static const LocalType *resolve_local_type(Symbol *s) {
+    for (auto ri = LOCAL_TYPES.rbegin(); ri != LOCAL_TYPES.rend(); ri++) {
+        auto lcl = ri->find(s);
+        if (lcl != ri->end())
+            return &lcl->second;
+    }
+
+    return nullptr;
+}
+
 SymbolExpr *SymbolExpr::parse(Symbol *s) {
-    cerr << "SymbolExpr::parse - " << print_form(s) << endl;
+    TRACE(2, "SymbolExpr::parse - " << print_form(s));
 
-    if (! resolve_local(s) && GLOBAL_DEFS.find(s) == GLOBAL_DEFS.end())
-        throw CompileError("Undefined symbol: ", s->name());
+    if (! is_local(s) && ! GLOBAL_DEFS.contains(s))
+        throw CompileError("Undefined symbol: ", s->name().str());
 
     return new SymbolExpr(s);
 }
 
+ValType SymbolExpr::infer() {
+    const LocalType *lt = resolve_local_type(_sym);
+    return _type = lt ? lt->type : T_ANY;
+}
+
+// A local of a specialized entry point may be unboxed; the Value's own
+// type says which.
+Value *SymbolExpr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    Value *symval = resolve_local(_sym);
+    if (symval && symval->getType() == native_type(_type))
+        return symval;
+    return Expr::emit_unboxed(ctx, mod, builder);
+}
+
 Value *SymbolExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
     Value *symval = resolve_local(_sym);
-    if (symval) return symval;
+    if (symval) {
+        if (symval->getType() == native_type(T_INT))
+            return emit_box(builder, mod, symval, T_INT);
+        if (symval->getType() == native_type(T_DOUBLE))
+            return emit_box(builder, mod, symval, T_DOUBLE);
+        return symval;
+    }
     
-    auto gbl = GLOBAL_DEFS.find(_sym);
-    if (gbl == GLOBAL_DEFS.end())
-        throw CompileError("CRITICAL ERROR: Unbound symbol in emit! ", _sym->name());
+    if (! GLOBAL_DEFS.contains(_sym))
+        throw CompileError("CRITICAL ERROR: Unbound symbol in emit! ", _sym->name().str());
 
-    symval = gbl->second;
+    symval = GLOBAL_DEFS.lookup(_sym);
     if (!symval)
-        throw CompileError("Unbound symbol: ", _sym->name());
+        throw CompileError("Unbound symbol: ", _sym->name().str());
 
     return builder.CreateLoad(symval);
 }
 
 InvokeExpr *InvokeExpr::parse(Pair *lis) {
-    cerr << "InvokeExpr::parse - " << print_form(lis) << endl;
-    if (! listp(lis))
-        throw CompileError("function invocation must be a proper list");
+    TRACE(2, "InvokeExpr::parse - " << print_form(lis));
 
     InvokeExpr *ie = new InvokeExpr(lis);
     ie->_func = Expr::parse(lis->car());
-
-    Pair *rest = dyn_cast_or_null<Pair>(lis->cdr());
-    while (rest) {
-        ie->_params.push_back(Expr::parse(rest->car()));
-        rest = dyn_cast_or_null<Pair>(rest->cdr());
-    }
+    each_arg(lis, "function invocation", [&](Form *arg, size_t) {
+        ie->_params.push_back(Expr::parse(arg));
+    });
     return ie;
 }
 
@@ -281,9 +863,886 @@ Value *InvokeExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
         throw CompileError(ss.str());
     }
 
+    if (_spec_fn)
+        return emit_box(builder, mod, emit_spec_call(ctx, mod, builder), _type);
+
+    Type *ptr = TypeBuilder<void*,false>::get(getGlobalContext());
+    vector<Value*> args;
+    for (Expr *e : _params)
+        args.push_back(builder.CreatePointerCast(e->emit(C_EXPRESSION, mod, builder), ptr));
+
+    return emit_call(builder, f, args, ctx);
+}
+
+// A call to a function the callee expression is known to be, with some
+// argument known to be a number, goes to its entry point for the argument
+// types, with those arguments passed unboxed.
+ValType InvokeExpr::infer() {
+    _func->infer();
+    _spec_fn = nullptr;
+    _arg_types.clear();
+
+    bool numeric = false;
+    for (Expr *e : _params) {
+        ValType t = e->infer();
+        if (t == T_NONE)
+            return _type = T_NONE;
+        numeric |= is_unboxed(t);
+        _arg_types.push_back(t);
+    }
+
+    FnExpr *fe = dyn_cast<FnExpr>(_func);
+    if (SymbolExpr *se = dyn_cast<SymbolExpr>(_func))
+        if (const LocalType *lt = resolve_local_type(se->symbol()))
+            fe = lt->fn;
+
+    if (fe && numeric && fe->arity() == _params.size()) {
+        bool ok;
+        ValType ret = fe->spec_type(_arg_types, ok);
+        if (ok) {
+            _spec_fn = fe;
+            return _type = ret;
+        }
+    }
+    return _type = T_ANY;
+}
+
+Value *InvokeExpr::emit_spec_call(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    Function *f = _spec_fn->specialize(_arg_types, mod, builder);
+    vector<Value*> args;
+    for (size_t i = 0; i < _params.size(); ++i)
+        args.push_back(_params[i]->emit_as(_arg_types[i], mod, builder));
+    return emit_call(builder, f, args, ctx);
+}
+
+Value *InvokeExpr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    // Emitted for its side effects and the generic entry point the
+    // specialized one's own name refers to.
+    _func->emit(C_EXPRESSION, mod, builder);
+    return emit_spec_call(ctx, mod, builder);
+}
+
+VectorExpr *VectorExpr::parse(Vector *v) {
+    VectorExpr *ve = new VectorExpr(v);
+    for (size_t i = 0; i < v->count(); ++i)
+        ve->_elems.push_back(Expr::parse(v->nth(i)));
+    return ve;
+}
+
+// Calls a runtime function taking (Form **args, long n) with the values
+// stored in a stack array, which the callee must copy if it keeps them.
+static Value *emit_array_call(IRBuilder<> &builder, Module *mod, const char *name,
+                              const vector<Value*> &vals) {
+    LLVMContext &c = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(c);
+    Type *word = Type::getInt64Ty(c);
+
+    // In the entry block, so a call inside a loop reuses one slot.
+    BasicBlock &entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+    IRBuilder<> top(&entry, entry.begin());
+    Value *arr = top.CreateAlloca(ptr, ConstantInt::get(Type::getInt32Ty(c), vals.size()), "args");
+
+    for (size_t i = 0; i < vals.size(); ++i)
+        builder.CreateStore(builder.CreatePointerCast(vals[i], ptr), builder.CreateConstGEP1_64(arr, i));
+
+    Function *f = runtime_fn(mod, name, ptr, {ptr->getPointerTo(), word});
+    return emit_checked_call(builder, f, {arr, ConstantInt::get(word, vals.size())});
+}
+
+ValType VectorExpr::infer() {
+    for (Expr *e : _elems)
+        e->infer();
+    return _type = T_ANY;
+}
+
+Value *VectorExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    if (_elems.empty())
+        return form_ptr(_form, builder);
+
+    vector<Value*> vals;
+    for (Expr *e : _elems)
+        vals.push_back(e->emit(C_EXPRESSION, mod, builder));
+    return emit_array_call(builder, mod, "vector_of", vals);
+}
+
+// The guards an inline indexed load needs: coll is a heap object of one of
+// kinds and index a fixnum below its count. Any failure branches to slow;
+// the builder is left in the block where they all passed. Returns the
+// unboxed index and sets kind to the kind byte. Every indexed form keeps
+// its 32-bit count after the kind byte and its elements one word in.
+static Value *emit_index_checks(IRBuilder<> &builder, Value *coll, Value *index,
+                                ArrayRef<Form::FormKind> kinds, BasicBlock *slow, Value *&kind) {
+    LLVMContext &c = getGlobalContext();
+    Type *i8 = Type::getInt8Ty(c);
+    Type *i32 = Type::getInt32Ty(c);
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *kind_bb = BasicBlock::Create(c, "index_kind", f);
+    BasicBlock *bounds_bb = BasicBlock::Create(c, "index_bounds", f);
+    BasicBlock *ok_bb = BasicBlock::Create(c, "index_ok", f);
+
+    // Only a non-nil heap pointer has a kind byte to read.
+    Value *word = form_word(builder, coll);
+    Value *is_obj = builder.CreateAnd(
+        builder.CreateICmpNE(word, ConstantInt::get(word->getType(), 0)),
+        builder.CreateICmpEQ(builder.CreateAnd(word, IMMEDIATE_MASK),
+                             ConstantInt::get(word->getType(), 0)));
+    builder.CreateCondBr(builder.CreateAnd(is_obj, emit_is_fixnum(builder, index)), kind_bb, slow);
+
+    builder.SetInsertPoint(kind_bb);
+    kind = builder.CreateLoad(builder.CreatePointerCast(coll, i8->getPointerTo()), "kind");
+    Value *kind_ok = builder.getFalse();
+    for (Form::FormKind k : kinds)
+        kind_ok = builder.CreateOr(kind_ok, builder.CreateICmpEQ(kind, ConstantInt::get(i8, k)));
+    builder.CreateCondBr(kind_ok, bounds_bb, slow);
+
+    // A negative index compares as huge.
+    builder.SetInsertPoint(bounds_bb);
+    Value *count_ptr = builder.CreateConstGEP1_32(builder.CreatePointerCast(coll, i32->getPointerTo()), 1);
+    Value *count = builder.CreateZExt(builder.CreateLoad(count_ptr, "count"), Type::getInt64Ty(c));
+    Value *i = emit_fixnum_val(builder, index);
+    builder.CreateCondBr(builder.CreateICmpULT(i, count), ok_bb, slow);
+
+    builder.SetInsertPoint(ok_bb);
+    return i;
+}
+
+// (nth v i) on a vector with an in-range fixnum index is a load from the
+// element array; anything else (lists, arrays, boxed indexes, errors) goes
+// to builtin_nth.
+static Value *emit_nth(IRBuilder<> &builder, Module *mod, vector<Value*> &args) {
+    LLVMContext &c = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(c);
+    Value *coll = args[0], *index = args[1];
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *slow_bb = BasicBlock::Create(c, "nth_slow", f);
+    BasicBlock *done_bb = BasicBlock::Create(c, "nth_done", f);
+
+    Value *kind;
+    Value *i = emit_index_checks(builder, coll, index, Form::FK_Vector, slow_bb, kind);
+    Value *elems = builder.CreateConstGEP1_32(builder.CreatePointerCast(coll, ptr->getPointerTo()), 1);
+    Value *elem = builder.CreateLoad(builder.CreateGEP(elems, i), "elem");
+    BasicBlock *load_bb = builder.GetInsertBlock();
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(slow_bb);
+    Function *nth_fn = runtime_fn(mod, "builtin_nth", ptr, {ptr, ptr});
+    Value *slow = emit_checked_call(builder, nth_fn, {coll, index});
+    slow_bb = builder.GetInsertBlock();
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(done_bb);
+    PHINode *res = builder.CreatePHI(ptr, 2, "nth");
+    res->addIncoming(elem, load_bb);
+    res->addIncoming(slow, slow_bb);
+    return res;
+}
+
+// (aget a i) loads the raw element straight out of an f64 or i64 array and
+// tags it in place when it fits an immediate. builtin_aget boxes the rest
+// and reports errors.
+static Value *emit_aget(IRBuilder<> &builder, Module *mod, vector<Value*> &args) {
+    LLVMContext &c = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(c);
+    Type *word = Type::getInt64Ty(c);
+    Value *arr = args[0], *index = args[1];
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *int_bb = BasicBlock::Create(c, "aget_int", f);
+    BasicBlock *float_bb = BasicBlock::Create(c, "aget_float", f);
+    BasicBlock *slow_bb = BasicBlock::Create(c, "aget_slow", f);
+    BasicBlock *done_bb = BasicBlock::Create(c, "aget_done", f);
+
+    static const Form::FormKind kinds[] = { Form::FK_F64Array, Form::FK_I64Array };
+    Value *kind;
+    Value *i = emit_index_checks(builder, arr, index, kinds, slow_bb, kind);
+    Value *elems = builder.CreateConstGEP1_32(builder.CreatePointerCast(arr, word->getPointerTo()), 1);
+    Value *raw = builder.CreateLoad(builder.CreateGEP(elems, i), "raw");
+    Value *is_int = builder.CreateICmpEQ(kind, ConstantInt::get(kind->getType(), Form::FK_I64Array));
+    builder.CreateCondBr(is_int, int_bb, float_bb);
+
+    // A long fits a fixnum when shifting the tag bit in and out keeps it.
+    builder.SetInsertPoint(int_bb);
+    Value *fits = builder.CreateICmpEQ(builder.CreateAShr(builder.CreateShl(raw, 1), 1), raw);
+    Value *fixnum = emit_make_fixnum(builder, raw);
+    builder.CreateCondBr(fits, done_bb, slow_bb);
+
+    builder.SetInsertPoint(float_bb);
+    Value *float_fits;
+    Value *flonum = emit_make_flonum(builder, raw, float_fits);
+    builder.CreateCondBr(float_fits, done_bb, slow_bb);
+
+    builder.SetInsertPoint(slow_bb);
+    Function *aget_fn = runtime_fn(mod, "builtin_aget", ptr, {ptr, ptr});
+    Value *slow = emit_checked_call(builder, aget_fn, {arr, index});
+    BasicBlock *slow_end = builder.GetInsertBlock();
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(done_bb);
+    PHINode *res = builder.CreatePHI(ptr, 3, "aget");
+    res->addIncoming(fixnum, int_bb);
+    res->addIncoming(flonum, float_bb);
+    res->addIncoming(slow, slow_end);
+    return res;
+}
+
+// Arithmetic and comparison. Two fixnums or two flonums are handled inline;
+// anything else, and any result that doesn't fit an immediate, goes to the
+// runtime function for the op, which also reports type errors.
+enum NumOp { NUM_ADD, NUM_SUB, NUM_MUL, NUM_DIV };
+enum NumCmp { CMP_LT, CMP_LE, CMP_EQ, CMP_GE, CMP_GT };
+
+static const struct {
+    const char *name;
+    const char *runtime;
+    long identity;
+} NUM_OPS[] = {
+    { "+", "builtin_add", 0 },
+    { "-", "builtin_sub", 0 },
+    { "*", "builtin_mul", 1 },
+    { "/", "builtin_div", 1 },
+};
+
+static const struct {
+    const char *name;
+    const char *runtime;
+    CmpInst::Predicate int_pred;
+    CmpInst::Predicate float_pred;
+} NUM_CMPS[] = {
+    { "<",  "builtin_lt",     CmpInst::ICMP_SLT, CmpInst::FCMP_OLT },
+    { "<=", "builtin_le",     CmpInst::ICMP_SLE, CmpInst::FCMP_OLE },
+    { "=",  "builtin_num_eq", CmpInst::ICMP_EQ,  CmpInst::FCMP_OEQ },
+    { ">=", "builtin_ge",     CmpInst::ICMP_SGE, CmpInst::FCMP_OGE },
+    { ">",  "builtin_gt",     CmpInst::ICMP_SGT, CmpInst::FCMP_OGT },
+};
+
+static Value *emit_both_fixnum(IRBuilder<> &builder, Value *a, Value *b) {
+    Value *tags = builder.CreateAnd(builder.CreateAnd(form_word(builder, a), form_word(builder, b)), FIXNUM_TAG);
+    return builder.CreateICmpNE(tags, ConstantInt::get(tags->getType(), 0), "both_fixnum");
+}
+
+static Value *emit_arith2(IRBuilder<> &builder, Module *mod, NumOp op, Value *a, Value *b) {
+    LLVMContext &c = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(c);
+    Type *word = Type::getInt64Ty(c);
+    Value *zero = ConstantInt::get(word, 0);
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *int_bb = BasicBlock::Create(c, "arith_int", f);
+    BasicBlock *float_test_bb = BasicBlock::Create(c, "arith_float_test", f);
+    BasicBlock *float_bb = BasicBlock::Create(c, "arith_float", f);
+    BasicBlock *slow_bb = BasicBlock::Create(c, "arith_slow", f);
+    BasicBlock *done_bb = BasicBlock::Create(c, "arith_done", f);
+
+    builder.CreateCondBr(emit_both_fixnum(builder, a, b), int_bb, float_test_bb);
+
+    // The operands are 63-bit, so only * can overflow the 64-bit result;
+    // anything outside the fixnum range is left to the runtime to box.
+    builder.SetInsertPoint(int_bb);
+    Value *x = emit_fixnum_val(builder, a), *y = emit_fixnum_val(builder, b);
+    Value *r, *ok = builder.getTrue();
+    switch (op) {
+    case NUM_ADD: r = builder.CreateAdd(x, y); break;
+    case NUM_SUB: r = builder.CreateSub(x, y); break;
+    case NUM_MUL: {
+        Function *smul = Intrinsic::getDeclaration(mod, Intrinsic::smul_with_overflow, word);
+        Value *res = builder.CreateCall2(smul, x, y);
+        r = builder.CreateExtractValue(res, 0);
+        ok = builder.CreateNot(builder.CreateExtractValue(res, 1));
+        break;
+    }
+    case NUM_DIV: {
+        // Only an exact quotient stays an integer; srem needs y nonzero.
+        BasicBlock *div_bb = BasicBlock::Create(c, "arith_div", f);
+        builder.CreateCondBr(builder.CreateICmpNE(y, zero), div_bb, slow_bb);
+        builder.SetInsertPoint(div_bb);
+        ok = builder.CreateICmpEQ(builder.CreateSRem(x, y), zero);
+        r = builder.CreateSDiv(x, y);
+        break;
+    }
+    }
+    Value *fits = builder.CreateICmpEQ(builder.CreateAShr(builder.CreateShl(r, 1), 1), r);
+    Value *fixnum = emit_make_fixnum(builder, r);
+    BasicBlock *int_end = builder.GetInsertBlock();
+    builder.CreateCondBr(builder.CreateAnd(ok, fits), done_bb, slow_bb);
+
+    builder.SetInsertPoint(float_test_bb);
+    builder.CreateCondBr(builder.CreateAnd(emit_is_flonum(builder, a), emit_is_flonum(builder, b)),
+                         float_bb, slow_bb);
+
+    builder.SetInsertPoint(float_bb);
+    Value *fx = emit_flonum_val(builder, a), *fy = emit_flonum_val(builder, b);
+    Value *fr;
+    switch (op) {
+    case NUM_ADD: fr = builder.CreateFAdd(fx, fy); break;
+    case NUM_SUB: fr = builder.CreateFSub(fx, fy); break;
+    case NUM_MUL: fr = builder.CreateFMul(fx, fy); break;
+    case NUM_DIV: fr = builder.CreateFDiv(fx, fy); break;
+    }
+    Value *float_fits;
+    Value *flonum = emit_make_flonum(builder, builder.CreateBitCast(fr, word), float_fits);
+    builder.CreateCondBr(float_fits, done_bb, slow_bb);
+
+    builder.SetInsertPoint(slow_bb);
+    Function *slow_fn = runtime_fn(mod, NUM_OPS[op].runtime, ptr, {ptr, ptr});
+    Value *slow = emit_checked_call(builder, slow_fn, {a, b});
+    slow_bb = builder.GetInsertBlock();
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(done_bb);
+    PHINode *res = builder.CreatePHI(ptr, 3, NUM_OPS[op].name);
+    res->addIncoming(fixnum, int_end);
+    res->addIncoming(flonum, float_bb);
+    res->addIncoming(slow, slow_bb);
+    return res;
+}
+
+// Returns the comparison as an i1. Tagging keeps fixnums in order, so two
+// of them compare as words without being unpacked.
+static Value *emit_compare2(IRBuilder<> &builder, Module *mod, NumCmp cmp, Value *a, Value *b) {
+    LLVMContext &c = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(c);
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *int_bb = BasicBlock::Create(c, "cmp_int", f);
+    BasicBlock *float_test_bb = BasicBlock::Create(c, "cmp_float_test", f);
+    BasicBlock *float_bb = BasicBlock::Create(c, "cmp_float", f);
+    BasicBlock *slow_bb = BasicBlock::Create(c, "cmp_slow", f);
+    BasicBlock *done_bb = BasicBlock::Create(c, "cmp_done", f);
+
+    builder.CreateCondBr(emit_both_fixnum(builder, a, b), int_bb, float_test_bb);
+
+    builder.SetInsertPoint(int_bb);
+    Value *int_res = builder.CreateICmp(NUM_CMPS[cmp].int_pred, form_word(builder, a), form_word(builder, b));
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(float_test_bb);
+    builder.CreateCondBr(builder.CreateAnd(emit_is_flonum(builder, a), emit_is_flonum(builder, b)),
+                         float_bb, slow_bb);
+
+    builder.SetInsertPoint(float_bb);
+    Value *float_res = builder.CreateFCmp(NUM_CMPS[cmp].float_pred,
+                                          emit_flonum_val(builder, a), emit_flonum_val(builder, b));
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(slow_bb);
+    Function *slow_fn = runtime_fn(mod, NUM_CMPS[cmp].runtime, ptr, {ptr, ptr});
+    Value *slow_res = builder.CreateIsNotNull(emit_checked_call(builder, slow_fn, {a, b}));
+    slow_bb = builder.GetInsertBlock();
+    builder.CreateBr(done_bb);
+
+    builder.SetInsertPoint(done_bb);
+    PHINode *res = builder.CreatePHI(builder.getInt1Ty(), 3, NUM_CMPS[cmp].name);
+    res->addIncoming(int_res, int_bb);
+    res->addIncoming(float_res, float_bb);
+    res->addIncoming(slow_res, slow_bb);
+    return res;
+}
+
+// Folds left. With one operand the op's identity is the left side, so
+// (- x) negates and (/ x) is the reciprocal; (+) and (*) are the identity.
+static Value *emit_arith(IRBuilder<> &builder, Module *mod, NumOp op, vector<Value*> &args) {
+    if (args.empty() && (op == NUM_SUB || op == NUM_DIV))
+        throw CompileError(string(NUM_OPS[op].name) + " requires at least 1 argument");
+
+    size_t i = args.size() >= 2 ? 1 : 0;
+    Value *acc = i ? args[0] : form_ptr(make_int(NUM_OPS[op].identity), builder);
+    for (; i < args.size(); ++i)
+        acc = emit_arith2(builder, mod, op, acc, args[i]);
+    return acc;
+}
+
+// t or nil for an i1.
+static Value *emit_truth(IRBuilder<> &builder, Value *b) {
+    Type *ptr = TypeBuilder<void*,false>::get(getGlobalContext());
+    return builder.CreateSelect(b, builder.CreatePointerCast(form_ptr(Symbol::T, builder), ptr),
+                                ConstantPointerNull::get(cast<PointerType>(ptr)));
+}
+
+// (< a b c) holds when each neighbouring pair does.
+static Value *emit_compare_test(IRBuilder<> &builder, Module *mod, NumCmp cmp, vector<Value*> &args) {
+    if (args.empty())
+        throw CompileError(string(NUM_CMPS[cmp].name) + " requires at least 1 argument");
+
+    Value *all = builder.getTrue();
+    for (size_t i = 1; i < args.size(); ++i)
+        all = builder.CreateAnd(all, emit_compare2(builder, mod, cmp, args[i - 1], args[i]));
+    return all;
+}
+
+static Value *emit_compare(IRBuilder<> &builder, Module *mod, NumCmp cmp, vector<Value*> &args) {
+    return emit_truth(builder, emit_compare_test(builder, mod, cmp, args));
+}
+
+// The same two on operands inference has typed, unboxed in t. Integer
+// overflow calls the runtime function, which holds the error; integer / is never
+// typed T_INT, as it may not divide exactly.
+static Value *emit_typed_arith2(IRBuilder<> &builder, Module *mod, NumOp op, ValType t, Value *a, Value *b) {
+    if (t == T_DOUBLE) {
+        switch (op) {
+        case NUM_ADD: return builder.CreateFAdd(a, b);
+        case NUM_SUB: return builder.CreateFSub(a, b);
+        case NUM_MUL: return builder.CreateFMul(a, b);
+        case NUM_DIV: return builder.CreateFDiv(a, b);
+        }
+    }
+
+    LLVMContext &c = getGlobalContext();
+    Type *ptr = TypeBuilder<void*,false>::get(c);
+    Intrinsic::ID id = op == NUM_ADD ? Intrinsic::sadd_with_overflow
+                     : op == NUM_SUB ? Intrinsic::ssub_with_overflow
+                     : Intrinsic::smul_with_overflow;
+    Function *checked = Intrinsic::getDeclaration(mod, id, native_type(T_INT));
+    Value *res = builder.CreateCall2(checked, a, b);
+
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *overflow_bb = BasicBlock::Create(c, "arith_overflow", f);
+    BasicBlock *ok_bb = BasicBlock::Create(c, "arith_ok", f);
+    builder.CreateCondBr(builder.CreateExtractValue(res, 1), overflow_bb, ok_bb);
+
+    builder.SetInsertPoint(overflow_bb);
+    Function *slow_fn = runtime_fn(mod, NUM_OPS[op].runtime, ptr, {ptr, ptr});
+    emit_checked_call(builder, slow_fn, {emit_box(builder, mod, a, T_INT), emit_box(builder, mod, b, T_INT)});
+    builder.CreateUnreachable();
+
+    builder.SetInsertPoint(ok_bb);
+    return builder.CreateExtractValue(res, 0);
+}
+
+static Value *emit_typed_compare(IRBuilder<> &builder, Module *mod, NumCmp cmp, ValType t,
+                                 ExprList &params) {
+    vector<Value*> vals;
+    for (Expr *e : params)
+        vals.push_back(e->emit_as(t, mod, builder));
+
+    Value *all = builder.getTrue();
+    for (size_t i = 1; i < vals.size(); ++i) {
+        Value *holds = t == T_INT
+            ? builder.CreateICmp(NUM_CMPS[cmp].int_pred, vals[i - 1], vals[i])
+            : builder.CreateFCmp(NUM_CMPS[cmp].float_pred, vals[i - 1], vals[i]);
+        all = builder.CreateAnd(all, holds);
+    }
+    return all;
+}
+
+// (cons a d) pops its cell off the thread's free list inline.
+static Value *emit_cons2(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_cons(b, m, args[0], args[1]); }
+
+static Value *emit_add(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_arith(b, m, NUM_ADD, args); }
+static Value *emit_sub(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_arith(b, m, NUM_SUB, args); }
+static Value *emit_mul(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_arith(b, m, NUM_MUL, args); }
+static Value *emit_div(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_arith(b, m, NUM_DIV, args); }
+static Value *emit_lt(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_compare(b, m, CMP_LT, args); }
+static Value *emit_le(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_compare(b, m, CMP_LE, args); }
+static Value *emit_eq(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_compare(b, m, CMP_EQ, args); }
+static Value *emit_ge(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_compare(b, m, CMP_GE, args); }
+static Value *emit_gt(IRBuilder<> &b, Module *m, vector<Value*> &args) { return emit_compare(b, m, CMP_GT, args); }
+
+static const Builtin BUILTINS[] = {
+    { "+",  Builtin::VARIADIC, "builtin_add",    emit_add },
+    { "-",  Builtin::VARIADIC, "builtin_sub",    emit_sub },
+    { "*",  Builtin::VARIADIC, "builtin_mul",    emit_mul },
+    { "/",  Builtin::VARIADIC, "builtin_div",    emit_div },
+    { "<",  Builtin::VARIADIC, "builtin_lt",     emit_lt },
+    { "<=", Builtin::VARIADIC, "builtin_le",     emit_le },
+    { "=",  Builtin::VARIADIC, "builtin_num_eq", emit_eq },
+    { ">=", Builtin::VARIADIC, "builtin_ge",     emit_ge },
+    { ">",  Builtin::VARIADIC, "builtin_gt",     emit_gt },
+
+    { "cons",  2, "builtin_cons",  emit_cons2 },
+    { "list",  Builtin::VARIADIC, "builtin_list", nullptr },
+    { "nth",   2, "builtin_nth",   emit_nth },
+    { "count", 1, "builtin_count", nullptr },
+    { "conj",  2, "builtin_conj",  nullptr },
+    { "assoc", 3, "builtin_assoc", nullptr },
+
+    { "f64-array",   1, "builtin_f64_array",   nullptr },
+    { "i64-array",   1, "builtin_i64_array",   nullptr },
+    { "aget",        2, "builtin_aget",        emit_aget },
+    { "aset!",       3, "builtin_aset",        nullptr },
+    { "array-sum",   1, "builtin_array_sum",   nullptr },
+    { "array-dot",   2, "builtin_array_dot",   nullptr },
+    { "array-add",   2, "builtin_array_add",   nullptr },
+    { "array-scale", 2, "builtin_array_scale", nullptr },
+    { "array-min",   1, "builtin_array_min",   nullptr },
+    { "array-max",   1, "builtin_array_max",   nullptr },
+
+    { "str",     Builtin::VARIADIC, "builtin_str",     nullptr },
+    { "print",   Builtin::VARIADIC, "builtin_print",   nullptr },
+    { "println", Builtin::VARIADIC, "builtin_println", nullptr },
+};
+
+static SymbolMap<const Builtin*> builtin_table() {
+    SymbolMap<const Builtin*> table;
+    for (const Builtin &b : BUILTINS)
+        table[Symbol::intern(b.name)] = &b;
+    return table;
+}
+
+const Builtin *find_builtin(Symbol *s) {
+    static SymbolMap<const Builtin*> table = builtin_table();
+    if (is_local(s) || GLOBAL_DEFS.contains(s))
+        return nullptr;
+    return table.lookup(s);
+}
+
+BuiltinExpr *BuiltinExpr::parse(Pair *lis, const Builtin *b) {
+    TRACE(2, "BuiltinExpr::parse - " << print_form(lis));
+
+    BuiltinExpr *be = new BuiltinExpr(lis, b);
+    each_arg(lis, "function invocation", [&](Form *arg, size_t) {
+        be->_params.push_back(Expr::parse(arg));
+    });
+
+    if (b->arity != Builtin::VARIADIC && be->_params.size() != (size_t)b->arity) {
+        stringstream ss;
+        ss << "Wrong number of params: " << be->_params.size() << " for " << b->arity
+           << " in " << b->name;
+        throw CompileError(ss.str());
+    }
+
+    for (int i = 0; i < (int)(sizeof(NUM_OPS) / sizeof(NUM_OPS[0])); ++i)
+        if (! strcmp(b->runtime, NUM_OPS[i].runtime))
+            be->_num_op = i;
+    for (int i = 0; i < (int)(sizeof(NUM_CMPS) / sizeof(NUM_CMPS[0])); ++i)
+        if (! strcmp(b->runtime, NUM_CMPS[i].runtime))
+            be->_num_cmp = i;
+    return be;
+}
+
+// Arithmetic is typed by its operands: all integers give an integer
+// (except for /), any double among numbers a double. Comparisons give t or
+// nil, but are done unboxed when their operands are typed.
+ValType BuiltinExpr::infer() {
+    ValType operands = T_INT;
+    for (Expr *e : _params) {
+        ValType t = e->infer();
+        if (operands == T_ANY || t == T_ANY)
+            operands = T_ANY;
+        else if (operands == T_NONE || t == T_NONE)
+            operands = T_NONE;
+        else if (t == T_DOUBLE)
+            operands = T_DOUBLE;
+    }
+    _operand_type = operands;
+
+    if (_num_op < 0)
+        return _type = T_ANY;
+    if (_num_op == NUM_DIV && operands == T_INT)
+        return _type = T_ANY;
+    return _type = operands;
+}
+
+Value *BuiltinExpr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    NumOp op = (NumOp)_num_op;
+    if (_params.empty() && (op == NUM_SUB || op == NUM_DIV))
+        throw CompileError(string(NUM_OPS[op].name) + " requires at least 1 argument");
+
+    vector<Value*> vals;
+    for (Expr *e : _params)
+        vals.push_back(e->emit_as(_type, mod, builder));
+
+    size_t i = vals.size() >= 2 ? 1 : 0;
+    Value *acc = i ? vals[0]
+        : _type == T_INT ? (Value *)ConstantInt::get(native_type(T_INT), NUM_OPS[op].identity)
+        : ConstantFP::get(native_type(T_DOUBLE), NUM_OPS[op].identity);
+    for (; i < vals.size(); ++i)
+        acc = emit_typed_arith2(builder, mod, op, _type, acc, vals[i]);
+    return acc;
+}
+
+Value *BuiltinExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    Type *ptr = TypeBuilder<void*,false>::get(getGlobalContext());
+
+    if (is_unboxed(_type))
+        return emit_box(builder, mod, emit_unboxed(ctx, mod, builder), _type);
+    if (_num_cmp >= 0 && is_unboxed(_operand_type) && ! _params.empty())
+        return emit_truth(builder, emit_typed_compare(builder, mod, (NumCmp)_num_cmp, _operand_type, _params));
+
+    vector<Value*> args;
+    for (Expr *e : _params)
+        args.push_back(builder.CreatePointerCast(e->emit(C_EXPRESSION, mod, builder), ptr));
+
+    if (_builtin->emit_inline)
+        return _builtin->emit_inline(builder, mod, args);
+    if (_builtin->arity == Builtin::VARIADIC)
+        return emit_array_call(builder, mod, _builtin->runtime, args);
+
+    Function *f = runtime_fn(mod, _builtin->runtime, ptr, vector<Type*>(args.size(), ptr));
+    return emit_checked_call(builder, f, args);
+}
+
+// A comparison used as a test is the i1 itself, not t or nil.
+Value *BuiltinExpr::emit_test(Module *mod, IRBuilder<> &builder) {
+    if (_num_cmp < 0 || _params.empty())
+        return Expr::emit_test(mod, builder);
+    if (is_unboxed(_operand_type))
+        return emit_typed_compare(builder, mod, (NumCmp)_num_cmp, _operand_type, _params);
+
+    Type *ptr = TypeBuilder<void*,false>::get(getGlobalContext());
     vector<Value*> args;
     for (Expr *e : _params)
-        args.push_back(e->emit(C_EXPRESSION, mod, builder));
+        args.push_back(builder.CreatePointerCast(e->emit(C_EXPRESSION, mod, builder), ptr));
+    return emit_compare_test(builder, mod, (NumCmp)_num_cmp, args);
+}
+
+// The type of a value that may come from either of two expressions. A
+// branch that never gives one (T_NONE) doesn't count; an int and a double
+// stay apart, as converting would change the value's type.
+static ValType join(ValType a, ValType b) {
+    if (a == T_NONE) return b;
+    if (b == T_NONE) return a;
+    return a == b ? a : T_ANY;
+}
+
+IfExpr *IfExpr::parse(Pair *lis) {
+    TRACE(2, "IfExpr::parse - " << print_form(lis));
+
+    IfExpr *ie = new IfExpr(lis);
+    ie->_else = NIL_EXPR;
+    size_t n = each_arg(lis, "if", [&](Form *arg, size_t i) {
+        Expr *e = Expr::parse(arg);
+        if (i == 0) ie->_test = e;
+        else if (i == 1) ie->_then = e;
+        else ie->_else = e;
+    });
+    if (n != 2 && n != 3)
+        throw CompileError("if takes 2 or 3 arguments");
+    return ie;
+}
+
+ValType IfExpr::infer() {
+    _test->infer();
+    ValType then_type = _then->infer();
+    return _type = join(then_type, _else->infer());
+}
+
+// Both branches are emitted as want and meet in a phi; one that jumps away
+// feeds it undef from a block nothing reaches.
+Value *IfExpr::emit_branches(Expr::Context ctx, ValType want, Module *mod, IRBuilder<> &builder) {
+    LLVMContext &c = getGlobalContext();
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock *then_bb = BasicBlock::Create(c, "then", f);
+    BasicBlock *else_bb = BasicBlock::Create(c, "else", f);
+    BasicBlock *merge_bb = BasicBlock::Create(c, "endif", f);
+    Type *t = native_type(want);
+
+    builder.CreateCondBr(_test->emit_test(mod, builder), then_bb, else_bb);
+
+    builder.SetInsertPoint(then_bb);
+    Value *then_val = _then->emit_as(want, mod, builder, ctx);
+    if (! is_unboxed(want))
+        then_val = builder.CreatePointerCast(then_val, t);
+    then_bb = builder.GetInsertBlock();
+    builder.CreateBr(merge_bb);
+
+    builder.SetInsertPoint(else_bb);
+    Value *else_val = _else->emit_as(want, mod, builder, ctx);
+    if (! is_unboxed(want))
+        else_val = builder.CreatePointerCast(else_val, t);
+    else_bb = builder.GetInsertBlock();
+    builder.CreateBr(merge_bb);
+
+    builder.SetInsertPoint(merge_bb);
+    PHINode *phi = builder.CreatePHI(t, 2, "if");
+    phi->addIncoming(then_val, then_bb);
+    phi->addIncoming(else_val, else_bb);
+    return phi;
+}
+
+Value *IfExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    if (is_unboxed(_type))
+        return emit_box(builder, mod, emit_unboxed(ctx, mod, builder), _type);
+    return emit_branches(ctx, T_ANY, mod, builder);
+}
+
+Value *IfExpr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    return emit_branches(ctx, _type, mod, builder);
+}
+
+LoopExpr *LoopExpr::parse(Pair *lis) {
+    TRACE(2, "LoopExpr::parse - " << print_form(lis));
+
+    Pair *rest = dyn_cast_or_null<Pair>(lis->cdr());
+    Vector *bindings = rest ? dyn_cast_or_null<Vector>(rest->car()) : nullptr;
+    if (! bindings || bindings->count() % 2)
+        throw CompileError("loop requires a vector of name and init pairs");
+
+    LoopExpr *le = new LoopExpr(lis);
+    LOCALS.push_back(EnvMap());
+    try {
+        for (size_t i = 0; i < bindings->count(); i += 2) {
+            Symbol *name = dyn_cast_or_null<Symbol>(bindings->nth(i));
+            if (! name)
+                throw CompileError("loop binding names must be symbols");
+            // Parsed before its own name is bound, after the ones before.
+            le->_inits.push_back(Expr::parse(bindings->nth(i + 1)));
+            le->_names.push_back(name);
+            LOCALS.back()[name] = nullptr;
+        }
+
+        RECUR_TARGETS.push_back(RecurTarget { le, nullptr, le->_names.size() });
+        try {
+            le->_body = DoExpr::parse(cons(Symbol::DO, rest->cdr()), "loop");
+        } catch (...) {
+            RECUR_TARGETS.pop_back();
+            throw;
+        }
+        RECUR_TARGETS.pop_back();
+    } catch (...) {
+        LOCALS.pop_back();
+        throw;
+    }
+    LOCALS.pop_back();
+    return le;
+}
+
+// The bindings start as their inits' types and are widened by what the
+// body recurs with until they hold still.
+ValType LoopExpr::infer() {
+    LOCAL_TYPES.push_back(TypeMap());
+    _types.clear();
+    for (size_t i = 0; i < _inits.size(); ++i) {
+        ValType t = _inits[i]->infer();
+        _types.push_back(t == T_NONE ? T_ANY : t);
+        LOCAL_TYPES.back()[_names[i]] = LocalType { _types.back(), nullptr };
+    }
+
+    ValType ret;
+    for (;;) {
+        _recur_types = _types;
+        for (size_t i = 0; i < _names.size(); ++i)
+            LOCAL_TYPES.back()[_names[i]] = LocalType { _types[i], nullptr };
+        ret = _body->infer();
+        if (_recur_types == _types)
+            break;
+        // Each pass only widens, so this ends after at most two per binding.
+        _types = _recur_types;
+    }
+    LOCAL_TYPES.pop_back();
+    return _type = ret;
+}
+
+void LoopExpr::note_recur(const vector<ValType> &types) {
+    for (size_t i = 0; i < types.size(); ++i)
+        _recur_types[i] = join(_recur_types[i], types[i]);
+}
+
+// The inits are emitted before the loop header, whose phis the body sees
+// the bindings as and a recur feeds. The body's tail is the function's
+// only if the loop's is.
+Value *LoopExpr::emit_loop(Expr::Context ctx, ValType want, Module *mod, IRBuilder<> &builder) {
+    EnvMap env;
+    TypeMap scope;
+    LOCALS.push_back(env);
+    LOCAL_TYPES.push_back(scope);
+
+    vector<Value*> inits;
+    for (size_t i = 0; i < _inits.size(); ++i) {
+        Value *v = _inits[i]->emit_as(_types[i], mod, builder);
+        if (! is_unboxed(_types[i]))
+            v = builder.CreatePointerCast(v, native_type(T_ANY));
+        inits.push_back(v);
+        LOCALS.back()[_names[i]] = v;
+        LOCAL_TYPES.back()[_names[i]] = LocalType { _types[i], nullptr };
+    }
+
+    BasicBlock *pre_bb = builder.GetInsertBlock();
+    BasicBlock *header = BasicBlock::Create(getGlobalContext(), "loop", pre_bb->getParent());
+    builder.CreateBr(header);
+    builder.SetInsertPoint(header);
+
+    bool tail = ctx == C_RETURN && ! RECUR_FRAMES.empty() && RECUR_FRAMES.back().tail;
+    RecurFrame frame { nullptr, header, {}, _types, tail, nullptr };
+    for (size_t i = 0; i < _names.size(); ++i) {
+        PHINode *phi = builder.CreatePHI(native_type(_types[i]), 2, _names[i]->name());
+        phi->addIncoming(inits[i], pre_bb);
+        frame.phis.push_back(phi);
+        LOCALS.back()[_names[i]] = phi;
+    }
+
+    RECUR_FRAMES.push_back(frame);
+    Value *ret = _body->emit_as(want, mod, builder, C_RETURN);
+    RECUR_FRAMES.pop_back();
+    LOCAL_TYPES.pop_back();
+    LOCALS.pop_back();
+    return ret;
+}
+
+Value *LoopExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    if (is_unboxed(_type))
+        return emit_box(builder, mod, emit_unboxed(ctx, mod, builder), _type);
+    return emit_loop(ctx, T_ANY, mod, builder);
+}
+
+Value *LoopExpr::emit_unboxed(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    return emit_loop(ctx, _type, mod, builder);
+}
+
+RecurExpr *RecurExpr::parse(Pair *lis) {
+    TRACE(2, "RecurExpr::parse - " << print_form(lis));
+
+    if (RECUR_TARGETS.empty())
+        throw CompileError("recur outside of loop or fn");
+
+    RecurExpr *re = new RecurExpr(lis);
+    each_arg(lis, "recur", [&](Form *arg, size_t) {
+        re->_params.push_back(Expr::parse(arg));
+    });
+
+    const RecurTarget &target = RECUR_TARGETS.back();
+    if (re->_params.size() != target.arity) {
+        stringstream ss;
+        ss << "Wrong number of params to recur: " << re->_params.size() << " for " << target.arity;
+        throw CompileError(ss.str());
+    }
+    re->_loop = target.loop;
+    re->_fn = target.fn;
+    return re;
+}
+
+ValType RecurExpr::infer() {
+    vector<ValType> types;
+    for (Expr *e : _params)
+        types.push_back(e->infer());
+    if (_loop)
+        _loop->note_recur(types);
+    else
+        _fn->note_recur(types);
+    return _type = T_NONE;
+}
+
+Value *RecurExpr::emit(Expr::Context ctx, Module *mod, IRBuilder<> &builder) {
+    if (ctx != C_RETURN || RECUR_FRAMES.empty())
+        throw CompileError("recur must be in tail position");
 
-    return builder.CreateCall(f, args);
+    // Copied, as emitting the arguments may push and pop frames.
+    vector<ValType> types = RECUR_FRAMES.back().types;
+    vector<Value*> args;
+    for (size_t i = 0; i < _params.size(); ++i)
+        args.push_back(_params[i]->emit_as(types[i], mod, builder));
+
+    emit_jump(builder, RECUR_FRAMES.back(), args);
+    return emit_after_tail(builder, native_type(T_ANY));
+}
+
+// An entry point for argument types a recur passes values outside of can't
+// loop back into itself; spec_type then leaves calls on the generic one.
+void FnExpr::note_recur(const vector<ValType> &types) {
+    vector<ValType> key;
+    for (Symbol *arg : _arglist) {
+        const LocalType *lt = resolve_local_type(arg);
+        key.push_back(lt ? lt->type : T_ANY);
+    }
+    for (size_t i = 0; i < types.size(); ++i) {
+        bool fits = key[i] == T_ANY || types[i] == T_NONE || types[i] == key[i]
+            || (key[i] == T_DOUBLE && types[i] == T_INT);
+        if (fits)
+            continue;
+        auto spec = _specs.find(key);
+        if (spec != _specs.end())
+            spec->second.widened = true;
+        return;
+    }
 }
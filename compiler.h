@@ -18,6 +18,7 @@
 
 #include "lisp.h"
 
+#include <map>
 #include <vector>
 #include <unordered_map>
 
@@ -34,6 +35,136 @@ typedef unordered_map<Symbol*,Value*> EnvMap;
 typedef pair<Symbol*,Value*> EnvElem;
 typedef vector<EnvMap> EnvList;
 
+// A table indexed by Symbol::id() rather than hashed on the pointer. A
+// symbol can be present with a null value, which is how globals that have
+// been declared but not yet emitted are tracked.
+template<typename T>
+class SymbolMap {
+    vector<T> _vals;
+    vector<bool> _present;
+
+public:
+    bool contains(Symbol *s) const {
+        return s->id() < _present.size() && _present[s->id()];
+    }
+    T lookup(Symbol *s) const { return contains(s) ? _vals[s->id()] : T(); }
+
+    T &operator[](Symbol *s) {
+        if (s->id() >= _vals.size()) {
+            _vals.resize(s->id() + 1);
+            _present.resize(s->id() + 1);
+        }
+        _present[s->id()] = true;
+        return _vals[s->id()];
+    }
+
+    // Like unordered_map::insert, leaves an existing binding alone.
+    void insert(Symbol *s, T val) {
+        if (! contains(s))
+            (*this)[s] = val;
+    }
+};
+
+// Dump each function's IR as it is emitted. The REPL turns this on.
+extern bool DUMP_IR;
+
+// Compiler diagnostics on cerr, set from WOMBAT_TRACE: 1 traces each
+// top-level form, 2 every Expr parsed, 3 codegen. A message is only built
+// when its level is on.
+extern int TRACE_LEVEL;
+
+#define TRACE(level, msg) \
+    do { if (TRACE_LEVEL >= (level)) cerr << msg << endl; } while (0)
+
+// The optimizer, in optimizer.cc. OPT_LEVEL is -O0..-O3 and picks which
+// passes init_optimizer sets up; with TIME_PASSES each one is timed and
+// report_pass_times prints and clears the totals.
+extern unsigned OPT_LEVEL;
+extern bool TIME_PASSES;
+
+void init_optimizer(Module *mod, ExecutionEngine *ee);
+void optimize_function(Function *f);
+// Whole-module passes, for when a file has been compiled before it runs.
+void optimize_module(Module *mod);
+void report_pass_times(ostream &out, const string &input);
+
+// A pointer constant for f in the function being emitted. Heap forms are
+// rooted on behalf of that function until free_function drops it.
+Value *form_ptr(Form *f, IRBuilder<> &builder);
+// Erases a function that will never run again, releasing its machine code
+// (when ee is given) and the constants it embeds.
+void free_function(Function *f, ExecutionEngine *ee);
+// Erases every function mod gained after its first n: what a top-level
+// form that failed to compile left, finished or not.
+void drop_functions_after(Module *mod, size_t n);
+
+// Inline tests and conversions for immediate numbers (see FIXNUM_TAG), so
+// emitted code can handle them without calling out or touching memory.
+Value *emit_is_fixnum(IRBuilder<> &builder, Value *form);
+Value *emit_fixnum_val(IRBuilder<> &builder, Value *form);
+Value *emit_make_fixnum(IRBuilder<> &builder, Value *i);
+Value *emit_is_flonum(IRBuilder<> &builder, Value *form);
+Value *emit_flonum_val(IRBuilder<> &builder, Value *form);
+Value *emit_make_flonum(IRBuilder<> &builder, Value *bits, Value *&fits);
+
+// Inline small_alloc: pops the current thread's free list for the size
+// class, calling small_alloc_jit_refill only when it is empty.
+Value *emit_small_alloc(IRBuilder<> &builder, Module *mod, size_t size);
+Value *emit_cons(IRBuilder<> &builder, Module *mod, Value *car, Value *cdr);
+
+// A primitive the compiler knows by name. A call is emitted with
+// emit_inline when there is one, otherwise as a direct call to the runtime
+// function, which takes and returns Form*; a variadic one is passed
+// (Form **args, long n) instead. Local and global definitions shadow
+// builtins.
+struct Builtin {
+    enum { VARIADIC = -1 };
+
+    const char *name;
+    int arity;
+    const char *runtime;
+    Value *(*emit_inline)(IRBuilder<> &builder, Module *mod, vector<Value*> &args);
+};
+
+const Builtin *find_builtin(Symbol *s);
+
+// What inference knows about a value: nothing yet (a recursive call whose
+// result is still being worked out), nothing useful, or that it is always
+// an integer or always a double. Values of the last two are kept unboxed,
+// as i64 and double.
+enum ValType { T_NONE, T_ANY, T_INT, T_DOUBLE };
+
+inline bool is_unboxed(ValType t) { return t == T_INT || t == T_DOUBLE; }
+Type *native_type(ValType t);
+Value *emit_box(IRBuilder<> &builder, Module *mod, Value *v, ValType t);
+
+class FnExpr;
+
+// The types of the locals in scope while a body is inferred and emitted,
+// kept in step with LOCALS. fn is set for a function's own name.
+struct LocalType {
+    ValType type;
+    FnExpr *fn;
+};
+typedef unordered_map<Symbol*, LocalType> TypeMap;
+extern vector<TypeMap> LOCAL_TYPES;
+
+// Where recur, or a tail call of the function being emitted, jumps back
+// to: the top of the function or of a loop, with a phi per argument or
+// binding, which is what the body sees them as. fn is null for a loop.
+// tail says whether the frame's own tail is the function's, so a call
+// there can replace the function's frame. unwind is a fn's shared return
+// for a held error, made the first time a call needs it.
+struct RecurFrame {
+    Function *fn;
+    BasicBlock *header;
+    vector<PHINode*> phis;
+    vector<ValType> types;
+    bool tail;
+    BasicBlock *unwind;
+};
+extern vector<RecurFrame> RECUR_FRAMES;
+
 class Expr : public gc {
 public:
     enum ExprKind {
@@ -45,6 +176,12 @@ public:
         EK_NumberExpr,
         EK_SymbolExpr,
         EK_InvokeExpr,
+        EK_VectorExpr,
+        EK_BuiltinExpr,
+        EK_StringExpr,
+        EK_IfExpr,
+        EK_LoopExpr,
+        EK_RecurExpr,
     };
 
     enum Context {
@@ -64,12 +201,30 @@ public:
     virtual Symbol *symbol() { return dyn_cast_or_null<Symbol>(form()); }
     virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder) = 0;
 
+    // Type inference. A function body is inferred just before each time it
+    // is emitted, with its arguments typed for that entry point, and
+    // infer() records the result for type(). emit() always gives a boxed
+    // Form*; emit_unboxed() gives an i64 or double for an Expr inferred as
+    // T_INT or T_DOUBLE.
+    virtual ValType infer() { return _type = T_ANY; }
+    ValType type() const { return _type; }
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
+    // The value as an i1 for a branch: true unless nil.
+    virtual Value *emit_test(Module *mod, IRBuilder<> &builder);
+    // emit() or emit_unboxed() as want needs, converting if need be.
+    Value *emit_as(ValType want, Module *mod, IRBuilder<> &builder, Context ctx = C_EXPRESSION);
+
 protected:
     ExprKind _kind;
+    ValType _type;
 
-    Expr(ExprKind ek) : _kind(ek) {}
+    Expr(ExprKind ek) : _kind(ek), _type(T_ANY) {}
 };
 
+// An Expr's children. The storage is from the collector, and scanned, so a
+// child held only here lives as long as its parent.
+typedef vector<Expr*, gc_allocator<Expr*> > ExprList;
+
 class DefExpr : public Expr {
     Pair *_form;
 
@@ -84,8 +239,12 @@ public:
 
     virtual Form *form() { return _form; }
     virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
 };
 
+// Emits a generic entry point taking and returning boxed forms, and, for
+// calls whose arguments are known to be numbers, specialized entry points
+// taking and returning them unboxed.
 class FnExpr : public Expr {
     Pair *_form;
 
@@ -93,16 +252,49 @@ class FnExpr : public Expr {
     vector<Symbol*> _arglist;
     Expr *_body;
 
-    EnvList::reverse_iterator _env_i;
+    struct Spec {
+        ValType ret;
+        Function *fn;
+        bool settled;   // false while ret is still being worked out
+        bool widened;   // a recur passes what the arguments can't hold
+    };
+    map<vector<ValType>, Spec> _specs;
+    Function *_generic;
+    // Nonzero while the body is being inferred or emitted for some entry
+    // point, when other specializations can't be started.
+    unsigned _busy;
+    // Entry points asked for while the body was being emitted for another,
+    // whose types inferring it again would change. Emitted after it.
+    vector<vector<ValType> > _deferred;
+
+    FnExpr(Pair *p) : Expr(EK_FnExpr), _form(p), _name(nullptr), _generic(nullptr), _busy(0) {}
+
+    ValType infer_body(const vector<ValType> &types);
+    void emit_body(Function *f, const vector<ValType> &types, ValType ret,
+                   Module *mod, IRBuilder<> &builder);
 
-    FnExpr(Pair *p) : Expr(EK_FnExpr), _form(p) {}
-    
 public:
     static bool classof(const Expr *e) { return e->getKind() == EK_FnExpr; }
     static FnExpr *parse(Pair *lis);
 
     virtual Form *form() { return _form; }
     virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+
+    // emit() for a given calling convention: fastcc, which compiled code
+    // calls, unless C++ is to call it. The convention is set before the
+    // body is emitted, since emit_call only makes guaranteed tail calls
+    // from fastcc functions.
+    Function *emit_generic(CallingConv::ID cc, Module *mod, IRBuilder<> &builder);
+
+    size_t arity() const { return _arglist.size(); }
+    // The result type of the entry point for arguments of types, working
+    // it out if need be. ok is false when no such entry point can be made.
+    ValType spec_type(const vector<ValType> &types, bool &ok);
+    // That entry point, emitted on first use, or just after the body is if
+    // it is being emitted already. spec_type must have said ok.
+    Function *specialize(const vector<ValType> &types, Module *mod, IRBuilder<> &builder);
+    // Called by a recur's infer with the types it passes.
+    void note_recur(const vector<ValType> &types);
 };
 
 class QuoteExpr : public Expr {
@@ -122,17 +314,20 @@ public:
 class DoExpr : public Expr {
     Pair *_form;
 
-    vector<Expr*> _statements;
+    ExprList _statements;
     Expr *_ret_expr;
 
     DoExpr(Pair *p) : Expr(EK_DoExpr), _form(p) {}
 
 public:
     static bool classof(const Expr *e) { return e->getKind() == EK_DoExpr; }
-    static DoExpr *parse(Pair *lis);
+    // what names the form in errors: a fn body is parsed as a do.
+    static DoExpr *parse(Pair *lis, const char *what = "do");
 
     virtual Form *form() { return _form; }
     virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
 };
 
 class NilExpr : public Expr {
@@ -154,6 +349,8 @@ public:
 
     virtual Form *form() { return _form; }
     virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
 };
 
 class SymbolExpr : public Expr {
@@ -167,15 +364,23 @@ public:
 
     virtual Form *form() { return _sym; }
     virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
 };
 
 class InvokeExpr : public Expr {
     Pair *_form;
 
     Expr *_func;
-    vector<Expr*> _params;
+    ExprList _params;
+
+    // Set by infer when the call can go to a specialized entry point.
+    FnExpr *_spec_fn;
+    vector<ValType> _arg_types;
+
+    InvokeExpr(Pair *lis) : Expr(EK_InvokeExpr), _form(lis), _spec_fn(nullptr) {}
 
-    InvokeExpr(Pair *lis) : Expr(EK_InvokeExpr), _form(lis) {}
+    Value *emit_spec_call(Context ctx, Module *mod, IRBuilder<> &builder);
 
 public:
     static bool classof(const Expr *e) { return e->getKind() == EK_InvokeExpr; }
@@ -183,6 +388,137 @@ public:
 
     virtual Form *form() { return _form; }
     virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
+};
+
+class StringExpr : public Expr {
+    String *_form;
+
+    StringExpr(String *s) : Expr(EK_StringExpr), _form(s) {}
+
+public:
+    static bool classof(const Expr *e) { return e->getKind() == EK_StringExpr; }
+    static StringExpr *parse(String *s);
+
+    virtual Form *form() { return _form; }
+    virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+};
+
+class VectorExpr : public Expr {
+    Vector *_form;
+
+    ExprList _elems;
+
+    VectorExpr(Vector *v) : Expr(EK_VectorExpr), _form(v) {}
+
+public:
+    static bool classof(const Expr *e) { return e->getKind() == EK_VectorExpr; }
+    static VectorExpr *parse(Vector *v);
+
+    virtual Form *form() { return _form; }
+    virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+};
+
+class BuiltinExpr : public Expr {
+    Pair *_form;
+
+    const Builtin *_builtin;
+    ExprList _params;
+
+    // For arithmetic and comparisons: which one (else -1), and the type
+    // all the operands share, which the operation is done in.
+    int _num_op;
+    int _num_cmp;
+    ValType _operand_type;
+
+    BuiltinExpr(Pair *lis, const Builtin *b)
+        : Expr(EK_BuiltinExpr), _form(lis), _builtin(b), _num_op(-1), _num_cmp(-1), _operand_type(T_ANY) {}
+
+public:
+    static bool classof(const Expr *e) { return e->getKind() == EK_BuiltinExpr; }
+    static BuiltinExpr *parse(Pair *lis, const Builtin *b);
+
+    virtual Form *form() { return _form; }
+    virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual Value *emit_test(Module *mod, IRBuilder<> &builder);
+};
+
+// (if test then else?). Only nil is false.
+class IfExpr : public Expr {
+    Pair *_form;
+
+    Expr *_test;
+    Expr *_then;
+    Expr *_else;
+
+    IfExpr(Pair *p) : Expr(EK_IfExpr), _form(p) {}
+
+    Value *emit_branches(Context ctx, ValType want, Module *mod, IRBuilder<> &builder);
+
+public:
+    static bool classof(const Expr *e) { return e->getKind() == EK_IfExpr; }
+    static IfExpr *parse(Pair *lis);
+
+    virtual Form *form() { return _form; }
+    virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
+};
+
+// (loop [name init ...] body...), whose bindings a recur in the body's
+// tail rebinds before running it again. The inits are bound in order, each
+// seeing the ones before.
+class LoopExpr : public Expr {
+    Pair *_form;
+
+    vector<Symbol*> _names;
+    ExprList _inits;
+    Expr *_body;
+
+    // The bindings' types: their inits' widened by what recur passes.
+    vector<ValType> _types;
+    vector<ValType> _recur_types;
+
+    LoopExpr(Pair *p) : Expr(EK_LoopExpr), _form(p) {}
+
+    Value *emit_loop(Context ctx, ValType want, Module *mod, IRBuilder<> &builder);
+
+public:
+    static bool classof(const Expr *e) { return e->getKind() == EK_LoopExpr; }
+    static LoopExpr *parse(Pair *lis);
+
+    virtual Form *form() { return _form; }
+    virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
+    virtual Value *emit_unboxed(Context ctx, Module *mod, IRBuilder<> &builder);
+
+    size_t arity() const { return _names.size(); }
+    // Called by a recur's infer with the types it passes.
+    void note_recur(const vector<ValType> &types);
+};
+
+// (recur arg...) in the tail of the innermost loop or fn. Never gives a
+// value, so it is typed T_NONE.
+class RecurExpr : public Expr {
+    Pair *_form;
+
+    ExprList _params;
+    LoopExpr *_loop;    // null for a fn
+    FnExpr *_fn;        // null for a loop
+
+    RecurExpr(Pair *p) : Expr(EK_RecurExpr), _form(p), _loop(nullptr), _fn(nullptr) {}
+
+public:
+    static bool classof(const Expr *e) { return e->getKind() == EK_RecurExpr; }
+    static RecurExpr *parse(Pair *lis);
+
+    virtual Form *form() { return _form; }
+    virtual Value *emit(Context ctx, Module *mod, IRBuilder<> &builder);
+    virtual ValType infer();
 };
 
 #endif
@@ -1,9 +1,133 @@
 #include "lisp.h"
 
+#include "llvm/ADT/Hashing.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+// Symbols and their names are carved out of an append-only arena and never
+// freed, so a symbol is one contiguous allocation outside the GC heap. The
+// index is open-addressed on the precomputed hash.
+class SymbolShard {
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    char *_arena_cur;
+    size_t _arena_left;
+    vector<Symbol*> _slots;
+    unsigned _count;
+    mutex _lock;
+
+    void *arena_alloc(size_t size) {
+        size = (size + alignof(Symbol) - 1) & ~(alignof(Symbol) - 1);
+        if (size > _arena_left) {
+            size_t chunk = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+            _arena_cur = (char *)malloc(chunk);
+            if (! _arena_cur)
+                throw LispException("Out of memory interning symbol.");
+            _arena_left = chunk;
+        }
+        void *p = _arena_cur;
+        _arena_cur += size;
+        _arena_left -= size;
+        return p;
+    }
+
+    void grow() {
+        vector<Symbol*> old(_slots.size() * 2, nullptr);
+        old.swap(_slots);
+        size_t mask = _slots.size() - 1;
+        for (Symbol *sym : old) {
+            if (! sym) continue;
+            size_t i = sym->hash() & mask;
+            while (_slots[i])
+                i = (i + 1) & mask;
+            _slots[i] = sym;
+        }
+    }
+
+public:
+    SymbolShard() : _arena_cur(nullptr), _arena_left(0), _slots(256, nullptr), _count(0) {}
+
+    Symbol *intern(StringRef name, size_t hash, atomic<unsigned> &next_id) {
+        lock_guard<mutex> hold(_lock);
+        size_t mask = _slots.size() - 1;
+        size_t i = hash & mask;
+        for (Symbol *sym; (sym = _slots[i]); i = (i + 1) & mask)
+            if (sym->hash() == hash && sym->name() == name)
+                return sym;
+
+        char *mem = (char *)arena_alloc(sizeof(Symbol) + name.size() + 1);
+        char *n = mem + sizeof(Symbol);
+        memcpy(n, name.data(), name.size());
+        n[name.size()] = '\0';
+        Symbol *sym = new (mem) Symbol(name.size(), hash, next_id++);
+
+        _slots[i] = sym;
+        if (++_count * 2 > _slots.size())
+            grow();
+        return sym;
+    }
+};
+
+// Split on the top hash bits so threads reading in parallel rarely wait on
+// each other. Ids come from one counter, so they stay dense.
+class SymbolTable {
+    static const unsigned SHARDS = 16;
+
+    SymbolShard _shards[SHARDS];
+    atomic<unsigned> _next_id;
+
+public:
+    SymbolTable() : _next_id(0) {}
+
+    Symbol *intern(StringRef name) {
+        if (name.size() > UINT_MAX)
+            throw LispException("Symbol name too long.");
+        size_t hash = hash_value(name);
+        return _shards[(hash >> 28) % SHARDS].intern(name, hash, _next_id);
+    }
+};
+
+Symbol *Symbol::intern(StringRef name) {
+    static SymbolTable _syms;
+    return _syms.intern(name);
+}
+
 Symbol *const Symbol::DEF   = Symbol::intern("def");
 Symbol *const Symbol::QUOTE = Symbol::intern("quote");
 Symbol *const Symbol::FN    = Symbol::intern("fn");
 Symbol *const Symbol::DO    = Symbol::intern("do");
+Symbol *const Symbol::IF    = Symbol::intern("if");
+Symbol *const Symbol::LOOP  = Symbol::intern("loop");
+Symbol *const Symbol::RECUR = Symbol::intern("recur");
+Symbol *const Symbol::T     = Symbol::intern("t");
+
+// Slots are claimed without locking; racing readers may each box the
+// same value, and the loser's Float is just garbage.
+static const unsigned FLOAT_CACHE_BITS = 12;
+static atomic<Float*> FLOAT_CACHE[1 << FLOAT_CACHE_BITS];
+
+Number *literal_float(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if (flonum_fits(bits))
+        return make_float(d);
+
+    atomic<Float*> &slot = FLOAT_CACHE[(bits * 0x9e3779b97f4a7c15ULL) >> (64 - FLOAT_CACHE_BITS)];
+    Float *f = slot.load(memory_order_acquire);
+    if (f) {
+        uint64_t cached;
+        double cd = double_val(f);
+        memcpy(&cached, &cd, sizeof(cached));
+        if (cached == bits)
+            return f;
+    }
+    f = new Float(d);
+    slot.store(f, memory_order_release);
+    return f;
+}
 
 bool listp(Form *f) {
     for(;;) {
@@ -14,13 +138,15 @@ bool listp(Form *f) {
     }
 }
 
-Form *listn(Form *e1, Form *e2, Form *e3, Form *e4, Form *e5, vector<Form*> &rest) {
-
-    Pair *tail = NIL;
-    for (int i = rest.size() - 1; i >= 0; --i)
-        tail = cons(rest.at(i), tail);
+Form *list_from_array(Form *const *elems, size_t n, Form *tail) {
+    if (! n)
+        return tail;
 
-    return cons(e1, cons(e2, cons(e3, cons(e4, cons(e5, tail)))));
+    Pair *cells = (Pair *)small_alloc(n * sizeof(Pair));
+    for (size_t i = 0; i + 1 < n; ++i)
+        new (cells + i) Pair(elems[i], cells + i + 1);
+    new (cells + n - 1) Pair(elems[n - 1], tail);
+    return cells;
 }
 
 int count(Pair *p) {
@@ -36,3 +162,22 @@ int count(Pair *p) {
     }
 }
 
+
+bool error_pending = false;
+static exception_ptr pending_error;
+
+void hold_current_error() {
+    if (error_pending)
+        return;
+    pending_error = current_exception();
+    error_pending = true;
+}
+
+void rethrow_pending_error() {
+    if (! error_pending)
+        return;
+    exception_ptr e = pending_error;
+    pending_error = nullptr;
+    error_pending = false;
+    rethrow_exception(e);
+}
@@ -1,68 +1,290 @@
 #include "lisp.h"
 #include "compiler.h"
 
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <limits>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
-string bleed_input(istream &input) {
-    string rem;
-    char rem_c[128];
+// An open file, closed when it goes out of scope; stdin is left open.
+class OpenFile {
+    int _fd;
+
+public:
+    OpenFile(const string &path)
+        : _fd(path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY)) {
+        if (_fd < 0)
+            throw LispException(string("Could not open ") + path);
+    }
+
+    ~OpenFile() {
+        if (_fd != STDIN_FILENO)
+            close(_fd);
+    }
+
+    OpenFile(const OpenFile &) = delete;
+    OpenFile &operator=(const OpenFile &) = delete;
+
+    int fd() { return _fd; }
+};
+
+// A source file mapped read-only. ok() is false for anything mmap refuses
+// (pipes, terminals, empty files); those are streamed instead.
+class MappedFile {
+    const char *_data;
+    size_t _size;
+
+public:
+    MappedFile(int fd) : _data(nullptr), _size(0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                _data = (const char *)m;
+                _size = st.st_size;
+            }
+        }
+    }
+
+    ~MappedFile() {
+        if (_data)
+            munmap((void *)_data, _size);
+    }
+
+    bool ok() { return _data != nullptr; }
+    const char *begin() { return _data; }
+    const char *end() { return _data + _size; }
+};
+
+// A form that fails to compile leaves nothing behind in mod; an error in
+// one function fails every function emitted for the form.
+Function *compile_toplevel(Form *f, Module *mod, IRBuilder<> &builder) {
+    TRACE(1, "compile - " << print_form(f));
+    size_t before = mod->size();
+    Function *func;
+    try {
+        FnExpr *thunk = cast<FnExpr>(Expr::parse(list3(Symbol::FN, nullptr, f)));
+        // Called from C++, unlike the fastcc functions compiled code calls.
+        func = thunk->emit_generic(CallingConv::C, mod, builder);
+    } catch (...) {
+        drop_functions_after(mod, before);
+        builder.ClearInsertionPoint();
+        throw;
+    }
+    return func;
+}
+
+// Runs a top-level thunk and frees it; it is never called again, and
+// anything it defined is held by its global's cell. An error a builtin
+// held on the way is thrown from here, outside compiled code.
+Form *run_toplevel(Function *func, ExecutionEngine *ee) {
+    void *fp = ee->getPointerToFunction(func);
+    Form *res = ((Form *(*)())(intptr_t)fp)();
+    free_function(func, ee);
+    rethrow_pending_error();
+    return res;
+}
+
+// Calls each(form) for every form in path, in order. Mapped files are read
+// whole (in parallel when large, or straight from a binary image); pipes
+// and terminals hand over each form as soon as its text has arrived.
+template<typename F>
+void read_file(const string &path, F each) {
+    OpenFile file(path);
+    int fd = file.fd();
+
+    MappedFile map(fd);
+    if (map.ok()) {
+        FormVector forms = is_binary(map.begin(), map.end())
+            ? read_binary(map.begin(), map.end())
+            : read_forms(map.begin(), map.end(), thread::hardware_concurrency());
+        for (Form *f : forms)
+            each(f);
+    } else {
+        IncrementalReader reader;
+        char chunk[65536];
+        ssize_t n;
+        Form *f;
+        do {
+            n = read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw LispException("Could not read " + path + ": " + strerror(errno));
+            if (n > 0)
+                reader.feed(chunk, n);
+            else
+                reader.finish();
+            while (reader.next(f))
+                each(f);
+        } while (n != 0);
+    }
+}
+
+// Reads every form in path, compiles them all, then runs them in order.
+// Nothing is printed unless a form fails. Each file gets a module of its
+// own, so the module passes only see what it compiled, not every function
+// loaded (and already in machine code) before it. Files share nothing in
+// IR: globals are reached through their cells, runtime functions by name.
+void load_file(const string &path, ExecutionEngine *ee, IRBuilder<> &builder) {
+    Module *mod = new Module(path, getGlobalContext());
+    ee->addModule(mod);
+    vector<Function*> thunks;
+
+    read_file(path, [&](Form *f) {
+        thunks.push_back(compile_toplevel(f, mod, builder));
+    });
+    optimize_module(mod);
+    report_pass_times(cerr, path);
+
+    for (Function *func : thunks)
+        run_toplevel(func, ee);
+}
+
+// Reads the given source files and writes their forms, unevaluated, as one
+// binary image that later loads skip the text reader for.
+void write_binary(const string &out_path, char **paths, int npaths) {
+    FormVector forms;
+    for (int i = 0; i < npaths; ++i)
+        read_file(paths[i], [&](Form *f) { forms.push_back(f); });
+
+    string image = print_binary(forms);
+    int fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, image.data(), image.size()) != (ssize_t)image.size())
+        throw LispException(string("Could not write ") + out_path);
+    close(fd);
+}
+
+// Collections and the time spent in them, counted by the collector's event
+// hook since the REPL last reported.
+struct GCStats {
+    unsigned collections;
+    double pause_ms;
+    chrono::steady_clock::time_point started;
+};
+
+static GCStats gc_stats;
+
+static void count_collection(GC_EventType event) {
+    if (event == GC_EVENT_START) {
+        gc_stats.started = chrono::steady_clock::now();
+    } else if (event == GC_EVENT_END) {
+        ++gc_stats.collections;
+        gc_stats.pause_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - gc_stats.started).count();
+    }
+}
+
+void repl(Module *mod, ExecutionEngine *ee, IRBuilder<> &builder) {
+    DUMP_IR = true;
+    GC_set_on_collection_event(count_collection);
+
+    IncrementalReader reader;
+    char chunk[4096];
+    ssize_t n;
     do {
-        input.clear(ios::goodbit);
-        input.getline(rem_c, streamsize(sizeof(rem_c)));
-        rem += rem_c;
-    } while (input.fail());
-    return rem;
+        if (! reader.pending())
+            cout << "> " << flush;
+
+        n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n > 0)
+            reader.feed(chunk, n);
+        else
+            reader.finish();
+
+        for (;;) {
+            try {
+                Form *f;
+                if (! reader.next(f))
+                    break;
+
+                Form *res = run_toplevel(compile_toplevel(f, mod, builder), ee);
+
+                cout << print_form(res) << endl;
+                report_pass_times(cerr, "input");
+
+                if (gc_stats.collections) {
+                    cerr << "; gc: " << gc_stats.collections << " collections, "
+                         << gc_stats.pause_ms << " ms paused" << endl;
+                    gc_stats.collections = 0;
+                    gc_stats.pause_ms = 0;
+                }
+            } catch (LispException e) {
+                cerr << "ERROR: " << e.what() << endl;
+            }
+        }
+    } while (n > 0);
+    mod->dump();
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     GC_INIT();
     InitializeNativeTarget();
+    if (const char *level = getenv("WOMBAT_TRACE"))
+        TRACE_LEVEL = atoi(level);
 
     Module *mod = new Module("wombat", getGlobalContext());
     string err;
-    ExecutionEngine *ee = EngineBuilder(mod).setErrorStr(&err).create();
+    // Makes fastcc calls marked tail and returned straight away real tail
+    // calls; see emit_call.
+    TargetOptions target_opts;
+    target_opts.GuaranteedTailCallOpt = true;
+    ExecutionEngine *ee = EngineBuilder(mod).setErrorStr(&err).setTargetOptions(target_opts).create();
     if (! ee) {
         cerr << "Could not create ExecutionEngine: " << err << endl;
         exit(1);
     }
     IRBuilder<> builder(getGlobalContext());
 
-    for (;;) {
-        try {
-            cout << "> ";
-            char c = cin.get();
-            if (cin.eof()) break;
-            cin.putback(c);
-            Form *f = read_form(cin);
-
-            // FOR DEBUGGING - Not sure if GC will keep working with compiled ptrs to the values :-/
-            GC_gcollect();
-            
-            string leftovers = bleed_input(cin);
-            if (leftovers.find_first_not_of(" \n\t") != string::npos)
-                throw ReaderError(string("Extraneous characters after input: ") + leftovers);
-
-            Expr *e = Expr::parse(list3(Symbol::FN, nullptr, f));
-            Function *func = dyn_cast<Function>(e->emit(Expr::C_EXPRESSION, mod, builder));
-            if (! func) {
-                cerr << "Failed to compile top-level function!" << endl;
-                exit(1);
-            }
-            void *fp = ee->getPointerToFunction(func);
-            Form *res = ((Form *(*)())(intptr_t)fp)();
+    // -O0..-O3 and --time-passes come before any other arguments.
+    int argi = 1;
+    for (; argi < argc; ++argi) {
+        string opt(argv[argi]);
+        if (opt.size() == 3 && opt[0] == '-' && opt[1] == 'O' && opt[2] >= '0' && opt[2] <= '3')
+            OPT_LEVEL = opt[2] - '0';
+        else if (opt == "--time-passes")
+            TIME_PASSES = true;
+        else
+            break;
+    }
+    init_optimizer(mod, ee);
+    argc -= argi - 1;
+    argv += argi - 1;
 
-            cout << print_form(res) << endl;
+    if (argc < 2) {
+        repl(mod, ee, builder);
+        return 0;
+    }
 
-            // stmt is a top-level expr, unbound, we don't need to keep it.
-            // Maybe later if we do repl history
-            //stmt->eraseFromParent();
-        } catch (LispException e) {
-            cerr << "ERROR: " << e.what() << endl;
+    if (string(argv[1]) == "--write-binary") {
+        if (argc < 4) {
+            cerr << "usage: " << argv[0] << " --write-binary OUT FILE..." << endl;
+            return 1;
         }
-    } 
-    mod->dump();
+        try {
+            write_binary(argv[2], argv + 3, argc - 3);
+        } catch (LispException &e) {
+            cerr << argv[2] << ": ERROR: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        try {
+            load_file(argv[i], ee, builder);
+        } catch (LispException &e) {
+            cerr << argv[i] << ": ERROR: " << e.what() << endl;
+            return 1;
+        }
+    }
     return 0;
 }
@@ -2,15 +2,21 @@
 #ifndef _WOMBAT_READER_H
 #define _WOMBAT_READER_H
 
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/IR/Function.h"
 
+#include <climits>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <exception>
 #include <unordered_map>
 #include <vector>
 
+#define GC_THREADS
 #include <gc/gc_cpp.h>
+#include <gc/gc_allocator.h>
 
 using namespace std;
 using namespace llvm;
@@ -40,11 +46,134 @@ public:
     Form *culprit() { return obj; }
 };
 
+class IndexError : public LispException {
+public:
+    IndexError(string m) : LispException(m) {}
+};
+
+// Nothing may be thrown through frames of compiled code, which the JIT
+// gives no unwind info. Builtins it calls catch what they throw and keep it
+// here, setting error_pending, which compiled code checks after each call
+// and returns on. Whoever called the top-level thunk then rethrows it. Only
+// the first error is kept until then.
+extern "C" bool error_pending;
+void hold_current_error();
+void rethrow_pending_error();
+
+// For a builtin's catch (...): keeps the exception and gives the dummy
+// value the builtin returns instead.
+template<typename T>
+inline T hold_error() {
+    hold_current_error();
+    return T();
+}
+
+// Numbers are usually immediates packed into the Form* itself rather than
+// heap objects. A set low bit marks a fixnum holding a 63-bit integer; low
+// bits 10 mark a flonum. Heap pointers are at least 4-byte aligned, so
+// their low bits are 00. Int and Float objects are only made for values
+// that don't fit.
+//
+// A flonum is the double's bits rotated left by three, which brings the
+// sign and the top two exponent bits down to the bottom. Those two
+// exponent bits always differ for binary exponents -255..256 (about 1e-77
+// to 1e77 in magnitude), so they are dropped for the tag and rebuilt from
+// the next exponent bit. That range plus +0.0, which gets its own word,
+// covers nearly every double arithmetic produces; only -0.0, subnormals,
+// huge values, infinities and NaNs are boxed. No 62-bit payload can hold
+// every double next to 63-bit fixnums without giving up pointer tags.
+const uintptr_t FIXNUM_TAG = 1;
+const uintptr_t FLONUM_TAG = 2;
+const uintptr_t IMMEDIATE_MASK = 3;
+const uintptr_t FLONUM_ZERO = 0x8000000000000002ULL;
+const long FIXNUM_MAX = LONG_MAX >> 1;
+const long FIXNUM_MIN = LONG_MIN >> 1;
+
+inline bool is_immediate(const Form *f) { return (uintptr_t)f & IMMEDIATE_MASK; }
+inline bool is_fixnum(const Form *f) { return (uintptr_t)f & FIXNUM_TAG; }
+inline bool is_flonum(const Form *f) { return ((uintptr_t)f & IMMEDIATE_MASK) == FLONUM_TAG; }
+
+// 0x3000000000000000 would rotate onto FLONUM_ZERO.
+inline bool flonum_fits(uint64_t bits) {
+    return bits == 0 || (bits != 0x3000000000000000ULL && ((bits >> 60) & 7) - 3 <= 1);
+}
+
+inline uintptr_t flonum_word(uint64_t bits) {
+    if (! bits)
+        return FLONUM_ZERO;
+    return (((bits << 3) | (bits >> 61)) & ~IMMEDIATE_MASK) | FLONUM_TAG;
+}
+
+inline long fixnum_val(const Form *f) { return (intptr_t)f >> 1; }
+inline double flonum_val(const Form *f) {
+    uint64_t w = (uintptr_t)f, bits = 0;
+    if (w != FLONUM_ZERO) {
+        w = (w & ~IMMEDIATE_MASK) | (2 - (w >> 63));
+        bits = (w >> 3) | (w << 61);
+    }
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// Allocation for the small fixed-size objects lists and boxed numbers are
+// made of. Each thread has a free list per 16-byte size class, refilled a
+// batch at a time with GC_malloc_many, so most allocations pop a pointer
+// without taking the collector's lock. The lists live in uncollectable
+// memory: the batch hanging off each head is reachable from nowhere else.
+const size_t SMALL_GRANULE = 16;
+const size_t SMALL_CLASSES = 4;     // objects up to 64 bytes
+
+struct SmallFreeLists {
+    void *heads[SMALL_CLASSES + 1];     // indexed by size in granules
+};
+
+extern thread_local SmallFreeLists *small_free_lists;
+
+// Refills an empty list and returns one object from it.
+void *small_alloc_refill(size_t cls);
+
+extern "C" {
+    // The calling thread's lists, created on first use. JIT'd code can't
+    // address thread-locals, so it fetches these once per function. If they
+    // can't be made it gets lists that stay empty, so the refill reports it.
+    SmallFreeLists *small_alloc_lists();
+    // small_alloc_refill for JIT'd code: an error is held, not thrown.
+    void *small_alloc_jit_refill(size_t cls);
+}
+
+// Gives a thread's lists back; the objects still on them become garbage.
+// Threads registered with the collector call this before unregistering.
+void small_alloc_release();
+
+inline void *small_alloc(size_t size) {
+    size_t cls = (size + SMALL_GRANULE - 1) / SMALL_GRANULE;
+    if (cls > SMALL_CLASSES)
+        return GC_MALLOC(size);
+
+    SmallFreeLists *lists = small_free_lists;
+    void *p;
+    if (lists && (p = lists->heads[cls])) {
+        lists->heads[cls] = GC_NEXT(p);
+        // The link is the only word GC_malloc_many leaves set; clear it so
+        // padding never holds a stale pointer.
+        GC_NEXT(p) = nullptr;
+        return p;
+    }
+    return small_alloc_refill(cls);
+}
+
+// Forms are plain tagged structs: no vtable, just a one-byte kind that
+// classof dispatches on, ahead of each subclass's fields.
 class Form : public gc {
 public:
-    enum FormKind {
+    enum FormKind : unsigned char {
         FK_Symbol,
         FK_Pair,
+        FK_Vector,
+        FK_F64Array,
+        FK_I64Array,
+        FK_String,
 
         FK_Number,
         FK_Float,
@@ -53,11 +182,17 @@ public:
 
         FK_Fn,
     };
-    
-    virtual ~Form() {};
 
     const FormKind getKind() const { return _kind; }
 
+    // Safe on immediates, which have no object to ask. Every classof goes
+    // through here.
+    static FormKind kindOf(const Form *f) {
+        if (is_fixnum(f)) return FK_Int;
+        if (is_flonum(f)) return FK_Float;
+        return f->getKind();
+    }
+
 private:
     const FormKind _kind;
 protected:
@@ -69,7 +204,11 @@ class Pair : public Form {
 public:
     Pair(Form *a, Form *d) : Form(FK_Pair), _a(a), _d(d) {}
 
-    static bool classof(const Form *f) { return f->getKind() == FK_Pair; }
+    void *operator new(size_t size) { return small_alloc(size); }
+    // For list_from_array, which lays cells out itself.
+    void *operator new(size_t, void *p) { return p; }
+
+    static bool classof(const Form *f) { return kindOf(f) == FK_Pair; }
 
     Form *car() { return _a; }
     Form *cdr() { return _d; }
@@ -77,15 +216,117 @@ public:
     void setcdr(Form *d) { _d = d; }
 };
 
+// A fixed run of forms stored inline after the header, so the whole vector
+// is one allocation and nth is a load. Vectors are never changed once
+// built; conj and assoc copy.
+class Vector : public Form {
+    // Packs into the padding after the kind byte, like Symbol's fields.
+    unsigned _count;
+
+    Vector(unsigned n) : Form(FK_Vector), _count(n) {}
+
+public:
+    // Elements start out NIL.
+    static Vector *make(size_t n);
+    static Vector *make(Form *const *elems, size_t n);
+
+    size_t count() const { return _count; }
+    Form **elems() { return (Form **)(this + 1); }
+    // Unchecked; i must be below count().
+    Form *nth(size_t i) { return elems()[i]; }
+
+    static bool classof(const Form *f) { return kindOf(f) == FK_Vector; }
+};
+
+// Unboxed numeric arrays: raw doubles or longs inline after the same
+// header as Vector. Elements are mutable, and allocated pointer-free so the
+// collector never scans them.
+template<typename T, Form::FormKind K>
+class NumArray : public Form {
+    unsigned _count;
+
+    NumArray(unsigned n) : Form(K), _count(n) {}
+
+public:
+    typedef T value_type;
+
+    // Elements start out zero.
+    static NumArray *make(size_t n);
+
+    size_t count() const { return _count; }
+    T *data() { return (T *)(this + 1); }
+
+    static bool classof(const Form *f) { return kindOf(f) == K; }
+};
+
+typedef NumArray<double, Form::FK_F64Array> F64Array;
+typedef NumArray<long, Form::FK_I64Array> I64Array;
+
+// Immutable text. A flat string keeps its bytes inline after the header,
+// NUL-terminated, in pointer-free memory. Concatenating long strings makes
+// a rope node pointing at both halves instead of copying, so building text
+// piece by piece stays linear. Ropes are never flattened in place; code
+// that needs the text walks the pieces.
+class String : public Form {
+    bool _rope;
+    unsigned _len;
+    size_t _hash;       // 0 until first asked for
+
+    String(bool rope, unsigned len) : Form(FK_String), _rope(rope), _len(len), _hash(0) {}
+
+    String **halves() { return (String **)(this + 1); }
+    static String *alloc_flat(size_t len);
+
+public:
+    // At or below this many bytes, concatenation copies.
+    static const size_t FLAT_MAX = 256;
+
+    static String *make(StringRef text);
+    static String *concat(String *a, String *b);
+
+    size_t size() const { return _len; }
+    bool flat() const { return ! _rope; }
+    // Only for flat strings.
+    StringRef text() const { return StringRef((const char *)(this + 1), _len); }
+    const char *c_str() const { return (const char *)(this + 1); }
+
+    // Calls each(StringRef) on the text piece by piece, in order. Iterative,
+    // so rope depth doesn't matter.
+    template<typename F> void each_piece(F each);
+
+    string str();
+    size_t hash();
+
+    static bool classof(const Form *f) { return kindOf(f) == FK_String; }
+};
+
+template<typename F>
+void String::each_piece(F each) {
+    // Every node is reachable from this, so the collector keeps them while
+    // the stack lives outside its heap.
+    vector<String*> pending(1, this);
+    while (! pending.empty()) {
+        String *s = pending.back();
+        pending.pop_back();
+        if (s->flat()) {
+            each(s->text());
+        } else {
+            pending.push_back(s->halves()[1]);
+            pending.push_back(s->halves()[0]);
+        }
+    }
+}
+
+// A Number* may be an immediate, so its value is only read through
+// long_val and double_val, never through a member.
 class Number : public Form {
 protected:
     Number(FormKind _k) : Form(_k) {}
 public:
-    virtual long long_val() = 0;
-    virtual double double_val() = 0;
+    void *operator new(size_t size) { return small_alloc(size); }
 
     static bool classof(const Form *f) {
-        return f->getKind() >= FK_Number && f->getKind() <= FK_NumberEnd;
+        return kindOf(f) >= FK_Number && kindOf(f) <= FK_NumberEnd;
     }
 };
 
@@ -93,48 +334,87 @@ class Float : public Number {
     double val;
 public:
     Float(double d) : Number(FK_Float), val(d) {}
-    virtual long long_val() { return (long)val; }
-    virtual double double_val() { return val; }
 
-    static bool classof(const Form *f) { return f->getKind() == FK_Float; }
+    static bool classof(const Form *f) { return kindOf(f) == FK_Float; }
+
+    friend long long_val(const Number *n);
+    friend double double_val(const Number *n);
 };
 
 class Int : public Number {
     long val;
 public:
     Int(long l) : Number(FK_Int), val(l) {}
-    virtual long long_val() { return val; }
-    virtual double double_val() { return (double)val; }
 
-    static bool classof(const Form *f) { return f->getKind() == FK_Int; }
+    static bool classof(const Form *f) { return kindOf(f) == FK_Int; }
+
+    friend long long_val(const Number *n);
+    friend double double_val(const Number *n);
 };
 
+inline long long_val(const Number *n) {
+    if (is_fixnum(n)) return fixnum_val(n);
+    if (is_flonum(n)) return (long)flonum_val(n);
+    if (n->getKind() == Form::FK_Int) return static_cast<const Int*>(n)->val;
+    return (long)static_cast<const Float*>(n)->val;
+}
+
+inline double double_val(const Number *n) {
+    if (is_fixnum(n)) return (double)fixnum_val(n);
+    if (is_flonum(n)) return flonum_val(n);
+    if (n->getKind() == Form::FK_Int) return (double)static_cast<const Int*>(n)->val;
+    return static_cast<const Float*>(n)->val;
+}
+
+inline Number *make_int(long l) {
+    if (l >= FIXNUM_MIN && l <= FIXNUM_MAX)
+        return (Number*)(((uintptr_t)l << 1) | FIXNUM_TAG);
+    return new Int(l);
+}
+
+inline Number *make_float(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if (flonum_fits(bits))
+        return (Number*)flonum_word(bits);
+    return new Float(d);
+}
+
+// make_float for literals. A value that still needs boxing is shared with
+// earlier literals of the same bits through a small direct-mapped cache, so
+// a file full of 0.1s keeps one Float. Arithmetic results rarely repeat and
+// stay with make_float.
+Number *literal_float(double d);
+
 class Symbol : public Form {
-    string n;
-protected:    
-    Symbol(string &_n) : Form(FK_Symbol), n(_n) {}
-    Symbol(const char *_n) : Form(FK_Symbol), n(_n) {}
-
-public:
-    static Symbol *intern(string name) {
-        static unordered_map<string, Symbol*> _syms;
-        auto s_iter = _syms.find(name);
-        if (s_iter == _syms.end()) {
-            auto res_pair = _syms.insert(pair<string, Symbol*>(name, new Symbol(name)));
-            if (res_pair.second)
-                return res_pair.first->second;
-            throw LispException("Failed to intern symbol.");
-        }
-        return s_iter->second;
-    }
-    const string &name() { return n; }
+    // Packs into the padding after the kind byte.
+    unsigned _id;
+    unsigned _len;
+    size_t _hash;
 
-    static bool classof(const Form *f) { return f->getKind() == FK_Symbol; }
+    // Only the interner makes symbols, with the name bytes directly after.
+    Symbol(size_t len, size_t hash, unsigned id)
+        : Form(FK_Symbol), _id(id), _len(len), _hash(hash) {}
+
+    friend class SymbolShard;
+
+public:
+    static Symbol *intern(StringRef name);
+    StringRef name() const { return StringRef((const char *)(this + 1), _len); }
+    size_t hash() const { return _hash; }
+    // Dense, starting at zero, in interning order.
+    unsigned id() const { return _id; }
+
+    static bool classof(const Form *f) { return kindOf(f) == FK_Symbol; }
 
     static Symbol *const DEF;
     static Symbol *const QUOTE;
     static Symbol *const FN;
     static Symbol *const DO;
+    static Symbol *const IF;
+    static Symbol *const LOOP;
+    static Symbol *const RECUR;
+    static Symbol *const T;
 };
 
 class Fn : public Form {
@@ -143,14 +423,161 @@ class Fn : public Form {
 public:
     Fn(Pair *s, Function *f) : Form(FK_Fn), _src(s), _fn(f) {}
 
-    static bool classof(const Form *f) { return f->getKind() == FK_Fn; }
+    static bool classof(const Form *f) { return kindOf(f) == FK_Fn; }
 
     Pair *src() { return _src; }
     Function *fn() { return _fn; }
 };
 
+static_assert(sizeof(Pair) == 3 * sizeof(void*), "Pair should be kind + car + cdr");
+static_assert(sizeof(Vector) == sizeof(void*), "Vector elements should start one word in");
+static_assert(sizeof(F64Array) == sizeof(void*) && sizeof(I64Array) == sizeof(void*),
+              "array elements should start one word in, as in Vector");
+static_assert(sizeof(String) == 2 * sizeof(void*), "String text should start two words in");
+static_assert(sizeof(Int) == 2 * sizeof(void*), "Int should be kind + value");
+static_assert(sizeof(Float) == 2 * sizeof(void*), "Float should be kind + value");
+
 #define NIL nullptr
 
+// Reads forms from a contiguous buffer (a mapped file, a slurped stream)
+// with a cursor. Symbol text is interned straight out of the buffer, so the
+// buffer only needs to outlive the Reader, not the forms it returns.
+class Reader {
+    // An open list or vector, or a pending quote. Nesting lives here rather
+    // than on the C++ stack, so depth and length are bounded only by memory.
+    struct Frame {
+        enum { RF_List, RF_Dot, RF_DotClose, RF_Quote, RF_Vector } kind;
+        size_t base;    // where its elements start in _items
+        Form *tail;     // after a '.'
+    };
+
+    const char *_cur, *_end;
+    vector<Frame, gc_allocator<Frame> > _stack;
+    // Elements of the open lists and vectors, innermost last. Each is built
+    // in one piece when it closes.
+    vector<Form*, gc_allocator<Form*> > _items;
+
+    Form *read_nested(bool in_list);
+    Form *read_atom();
+
+    int get() { return _cur < _end ? (unsigned char)*_cur++ : EOF; }
+    int peek() { return _cur < _end ? (unsigned char)*_cur : EOF; }
+    void unget() { --_cur; }
+    int killws();
+
+public:
+    Reader(const char *begin, const char *end) : _cur(begin), _end(end) {}
+    Reader(StringRef src) : _cur(src.begin()), _end(src.end()) {}
+
+    // Skips whitespace, returns true when no input remains.
+    bool at_end();
+    const char *position() { return _cur; }
+
+    Form *read_form();
+    Pair *read_list();
+    Form *read_number();
+    Symbol *read_symbol();
+    // Reads the rest of a string whose opening '"' has been consumed.
+    String *read_string();
+};
+
+// Finds top-level form boundaries without building anything: tracks list
+// depth, quotes and atom runs. Resumable, so a buffer can grow between
+// calls and each byte is still looked at once.
+class FormSplitter {
+    size_t _pos;        // scan position
+    size_t _start;      // start of the form being scanned, npos if none
+    int _depth;
+    bool _in_atom;
+    bool _in_string;
+    bool _escaped;      // last byte in a string was a backslash
+
+    bool take(size_t &start, size_t &end);
+
+public:
+    FormSplitter()
+        : _pos(0), _start(string::npos), _depth(0), _in_atom(false), _in_string(false), _escaped(false) {}
+
+    // Looks for the next complete form in buf[0, size). With eof set, a
+    // trailing partial form is returned as-is for the Reader to reject.
+    bool next(const char *buf, size_t size, bool eof, size_t &start, size_t &end);
+    // True while part of a form has been scanned.
+    bool pending() const { return _start != string::npos; }
+    // Forgets the bytes before the current form and returns how many there
+    // were, so the caller can drop them from its buffer.
+    size_t rebase();
+};
+
+// Push-style reader for input that arrives in pieces. feed() appends bytes;
+// next() hands back each form as soon as its text is complete, carrying a
+// partial form over to later calls.
+class IncrementalReader {
+    string _buf;
+    FormSplitter _split;
+    bool _eof;
+
+public:
+    IncrementalReader() : _eof(false) {}
+
+    void feed(const char *data, size_t len);
+    // No more input: a trailing atom is complete, an unclosed form is an error.
+    void finish() { _eof = true; }
+
+    // Returns false when no complete form is buffered. A form that fails to
+    // parse is dropped before the ReaderError propagates, so callers can
+    // report it and carry on calling next().
+    bool next(Form *&out);
+    // True while part of a form is buffered.
+    bool pending() const { return _split.pending(); }
+};
+
+typedef vector<Form*, gc_allocator<Form*> > FormVector;
+
+// Reads every form in [begin, end), in order. Inputs big enough to be
+// worth it are split at top-level form boundaries and parsed on up to
+// threads threads.
+FormVector read_forms(const char *begin, const char *end, unsigned threads);
+
+// Binary form images, for data that is loaded far more often than it is
+// edited. Layout:
+//
+//   "WMBF" version:u8
+//   nsyms:varint  { len:varint bytes }*     symbol table
+//   nforms:varint op*                      forms, in postfix
+//
+// Ops push onto a value stack: BIN_SYM idx, BIN_INT zigzag varint,
+// BIN_FLOAT 8 little-endian bytes, BIN_STRING len:varint bytes, BIN_NIL. BIN_LIST n pops n values into
+// a proper list; BIN_DOTTED n pops a tail and then n values; BIN_VECTOR n
+// pops n values into a vector. The stack is the form list once the ops run
+// out, so loading is one forward pass.
+enum BinaryOp : unsigned char {
+    BIN_NIL,
+    BIN_SYM,
+    BIN_INT,
+    BIN_FLOAT,
+    BIN_LIST,
+    BIN_DOTTED,
+    BIN_VECTOR,
+    BIN_STRING,
+};
+
+bool is_binary(const char *begin, const char *end);
+FormVector read_binary(const char *begin, const char *end);
+string print_binary(const FormVector &forms);
+
+// A numeric literal scanned without touching the heap.
+struct NumberLiteral {
+    enum { NL_Int, NL_Float } kind;
+    long l;
+    double d;
+};
+
+// Parses [begin, end) as one complete decimal, hex (0x), octal (leading 0)
+// or float literal. Returns false if the token is malformed or overflows.
+bool scan_number(const char *begin, const char *end, NumberLiteral &out);
+
+// istream adapters: each copies exactly one form's text off the stream and
+// hands it to a Reader, leaving the stream positioned just after the form.
 Form *read_form(istream &input);
 Pair *read_list(istream &input);
 Form *read_number(istream &input);
@@ -158,10 +585,14 @@ Symbol *read_symbol(istream &input);
 
 string print_form(Form *form);
 string print_list(Pair *pair);
+string print_vector(Vector *v);
+string print_f64_array(F64Array *a);
+string print_i64_array(I64Array *a);
 string print_number(Number *n);
 string print_int(Int *i);
 string print_float(Float *i);
 string print_symbol(Symbol *s);
+string print_string(String *s);
 
 extern "C" {
     bool listp(Form *p);
@@ -170,15 +601,83 @@ extern "C" {
 
     inline Pair *cons(Form *a, Form *d) { return new Pair(a, d); }
 
-    inline Form *list1(Form *elem) { return cons(elem, NIL); }
-    inline Form *list2(Form *e1, Form *e2) { return cons(e1, cons(e2, NIL)); }
-    inline Form *list3(Form *e1, Form *e2, Form *e3) { return cons(e1, cons(e2, cons(e3, NIL))); }
-    inline Form *list4(Form *e1, Form *e2, Form *e3, Form *e4) { return cons(e1, cons(e2, cons(e3, cons(e4, NIL)))); }
-    inline Form *list5(Form *e1, Form *e2, Form *e3, Form *e4, Form *e5) { return cons(e1, cons(e2, cons(e3, cons(e4, cons(e5, NIL))))); }
+    // The n elements as a list ending in tail (NIL for a proper list). All
+    // n cells come from one allocation, in order, so walking the list walks
+    // memory forwards. The cells live and die together: holding any one of
+    // them keeps the whole block.
+    Form *list_from_array(Form *const *elems, size_t n, Form *tail = NIL);
 
-    Form *listn(Form *e1, Form *e2, Form *e3, Form *e4, Form *e5, vector<Form*> &rest);
+    inline Form *list1(Form *elem) { return cons(elem, NIL); }
+    inline Form *list2(Form *e1, Form *e2) {
+        Form *elems[] = { e1, e2 };
+        return list_from_array(elems, 2);
+    }
+    inline Form *list3(Form *e1, Form *e2, Form *e3) {
+        Form *elems[] = { e1, e2, e3 };
+        return list_from_array(elems, 3);
+    }
+    inline Form *list4(Form *e1, Form *e2, Form *e3, Form *e4) {
+        Form *elems[] = { e1, e2, e3, e4 };
+        return list_from_array(elems, 4);
+    }
+    inline Form *list5(Form *e1, Form *e2, Form *e3, Form *e4, Form *e5) {
+        Form *elems[] = { e1, e2, e3, e4, e5 };
+        return list_from_array(elems, 5);
+    }
 
     int count(Pair *p);
+
+    // Builtins compiled code calls by name. They take and return forms,
+    // with integers as Int, and hold an error (see error_pending) on bad
+    // arguments.
+    Form *builtin_nth(Form *coll, Form *index);
+    Form *builtin_count(Form *coll);
+    Form *builtin_conj(Form *coll, Form *x);
+    Form *builtin_assoc(Form *coll, Form *index, Form *x);
+    Form *vector_of(Form **elems, long n);
+    Form *builtin_cons(Form *a, Form *d);
+    Form *builtin_list(Form **elems, long n);
+
+    // (str x ...) concatenates its arguments' text: strings as they are,
+    // nil as nothing, anything else as printed. (print x ...) and
+    // (println x ...) write the same text to stdout, space separated.
+    Form *builtin_str(Form **args, long n);
+    Form *builtin_print(Form **args, long n);
+    Form *builtin_println(Form **args, long n);
+
+    // (f64-array n) and (i64-array n) make zeroed arrays; given a vector or
+    // list of numbers instead, they convert it.
+    Form *builtin_f64_array(Form *src);
+    Form *builtin_i64_array(Form *src);
+    Form *builtin_aget(Form *arr, Form *index);
+    Form *builtin_aset(Form *arr, Form *index, Form *x);
+    Form *builtin_array_sum(Form *arr);
+    Form *builtin_array_dot(Form *a, Form *b);
+    Form *builtin_array_add(Form *a, Form *b);
+    Form *builtin_array_scale(Form *arr, Form *k);
+    Form *builtin_array_min(Form *arr);
+    Form *builtin_array_max(Form *arr);
+
+    // The generic paths behind + - * / and the comparisons, for operands
+    // compiled code didn't handle inline. Two integers give an integer
+    // (/ only when it divides exactly), anything else a float. Comparisons
+    // give t or nil.
+    Form *builtin_add(Form *a, Form *b);
+    Form *builtin_sub(Form *a, Form *b);
+    Form *builtin_mul(Form *a, Form *b);
+    Form *builtin_div(Form *a, Form *b);
+    Form *builtin_lt(Form *a, Form *b);
+    Form *builtin_le(Form *a, Form *b);
+    Form *builtin_num_eq(Form *a, Form *b);
+    Form *builtin_ge(Form *a, Form *b);
+    Form *builtin_gt(Form *a, Form *b);
+
+    // Boxing for compiled code that keeps numbers unboxed, and unboxing
+    // (with a type check) for the rare value it has to take back.
+    Form *box_long(long l);
+    Form *box_double(double d);
+    long unbox_long(Form *f);
+    double unbox_double(Form *f);
 }
 
 // inline bool nilp(Form *f) { return f == NIL; }
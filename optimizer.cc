@@ -0,0 +1,136 @@
+#include "compiler.h"
+
+#include "llvm/Transforms/IPO.h"
+
+#include <chrono>
+#include <iomanip>
+
+unsigned OPT_LEVEL = 2;
+bool TIME_PASSES = false;
+
+namespace {
+
+// One step of a pipeline. Under --time-passes each runs in a pass manager
+// of its own so its time can be told apart from the rest; otherwise a
+// pipeline's stages share one, run once per function or module.
+struct Stage {
+    const char *name;
+    unsigned level;         // the lowest -O level that runs it
+    bool needs_aa;          // give it basicaa rather than no-aa
+    Pass *(*create)();
+};
+
+const Stage FUNCTION_STAGES[] = {
+    { "mem2reg",      1, false, [] () -> Pass* { return createPromoteMemoryToRegisterPass(); } },
+    { "instcombine",  1, false, [] () -> Pass* { return createInstructionCombiningPass(); } },
+    { "simplifycfg",  1, false, [] () -> Pass* { return createCFGSimplificationPass(); } },
+    { "early-cse",    2, false, [] () -> Pass* { return createEarlyCSEPass(); } },
+    { "reassociate",  2, false, [] () -> Pass* { return createReassociatePass(); } },
+    { "gvn",          2, true,  [] () -> Pass* { return createGVNPass(); } },
+    { "sccp",         3, false, [] () -> Pass* { return createSCCPPass(); } },
+    { "licm",         3, true,  [] () -> Pass* { return createLICMPass(); } },
+    { "dse",          3, true,  [] () -> Pass* { return createDeadStoreEliminationPass(); } },
+    { "adce",         3, false, [] () -> Pass* { return createAggressiveDCEPass(); } },
+    { "simplifycfg",  2, false, [] () -> Pass* { return createCFGSimplificationPass(); } },
+};
+
+// Run over everything a file compiled to, once it has all been emitted.
+const Stage MODULE_STAGES[] = {
+    { "ipsccp",       2, false, [] () -> Pass* { return createIPSCCPPass(); } },
+    { "inline",       2, false, [] () -> Pass* { return createFunctionInliningPass(); } },
+    { "constmerge",   2, false, [] () -> Pass* { return createConstantMergePass(); } },
+};
+
+// A manager, the first stage in it, and the time spent in it since the
+// last report.
+template<typename PM>
+struct Timed {
+    const Stage *stage;
+    PM *pm;
+    double ms;
+    unsigned runs;
+};
+
+vector<Timed<FunctionPassManager> > function_pms;
+vector<Timed<PassManager> > module_pms;
+
+template<typename PM, typename Init>
+void build(vector<Timed<PM> > &pms, const Stage *begin, const Stage *end, ExecutionEngine *ee, Init init) {
+    PM *pm = nullptr;
+    bool has_aa = false;
+    for (const Stage *s = begin; s != end; ++s) {
+        if (OPT_LEVEL < s->level)
+            continue;
+        if (! pm || TIME_PASSES) {
+            pm = init();
+            pm->add(new DataLayout(*ee->getDataLayout()));
+            has_aa = false;
+            pms.push_back(Timed<PM> { s, pm, 0, 0 });
+        }
+        if (s->needs_aa && ! has_aa) {
+            pm->add(createBasicAliasAnalysisPass());
+            has_aa = true;
+        }
+        pm->add(s->create());
+    }
+}
+
+template<typename PM, typename IR>
+void run(vector<Timed<PM> > &pms, IR &ir) {
+    for (Timed<PM> &t : pms) {
+        if (! TIME_PASSES) {
+            t.pm->run(ir);
+            continue;
+        }
+        auto started = chrono::steady_clock::now();
+        t.pm->run(ir);
+        t.ms += chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+        ++t.runs;
+    }
+}
+
+template<typename PM>
+void report(ostream &out, const char *kind, vector<Timed<PM> > &pms) {
+    for (Timed<PM> &t : pms) {
+        if (! t.runs)
+            continue;
+        out << ";   " << kind << " " << left << setw(14) << t.stage->name << right
+            << fixed << setprecision(3) << setw(10) << t.ms << " ms  "
+            << t.runs << (t.runs == 1 ? " run" : " runs") << endl;
+        t.ms = 0;
+        t.runs = 0;
+    }
+}
+
+}
+
+// The function managers are made for mod but also run over functions in
+// the modules files are loaded into; none of the function stages keeps
+// anything per module.
+void init_optimizer(Module *mod, ExecutionEngine *ee) {
+    build(function_pms, begin(FUNCTION_STAGES), end(FUNCTION_STAGES), ee, [&] {
+        return new FunctionPassManager(mod);
+    });
+    for (auto &t : function_pms)
+        t.pm->doInitialization();
+
+    build(module_pms, begin(MODULE_STAGES), end(MODULE_STAGES), ee, [] {
+        return new PassManager();
+    });
+}
+
+void optimize_function(Function *f) {
+    run(function_pms, *f);
+}
+
+void optimize_module(Module *mod) {
+    run(module_pms, *mod);
+}
+
+void report_pass_times(ostream &out, const string &input) {
+    if (! TIME_PASSES)
+        return;
+    out << "; pass times for " << input << " at -O" << OPT_LEVEL << ":" << endl;
+    report(out, "fn ", function_pms);
+    report(out, "mod", module_pms);
+}
@@ -1,5 +1,6 @@
 #include "lisp.h"
 
+#include <cstring>
 #include <sstream>
 
 string print_form(Form *form) {
@@ -7,8 +8,16 @@ string print_form(Form *form) {
         return "()";
     if (isa<Pair>(form))
         return string("(") + print_list(cast<Pair>(form)) + ")";
+    if (isa<Vector>(form))
+        return print_vector(cast<Vector>(form));
+    if (isa<F64Array>(form))
+        return print_f64_array(cast<F64Array>(form));
+    if (isa<I64Array>(form))
+        return print_i64_array(cast<I64Array>(form));
     if (isa<Symbol>(form))
         return print_symbol(cast<Symbol>(form));
+    if (isa<String>(form))
+        return print_string(cast<String>(form));
     if (isa<Int>(form))
         return print_int(cast<Int>(form));
     if (isa<Float>(form))
@@ -26,8 +35,55 @@ string print_list(Pair *form) {
     return listr + " . " + print_form(form->cdr());
 }
 
+string print_vector(Vector *v) {
+    string vecstr("[");
+    for (size_t i = 0; i < v->count(); ++i) {
+        if (i) vecstr += " ";
+        vecstr += print_form(v->nth(i));
+    }
+    return vecstr + "]";
+}
+
+// Arrays have no reader syntax; these are for looking at them.
+string print_f64_array(F64Array *a) {
+    ostringstream arrstr;
+    arrstr << "#f64[";
+    for (size_t i = 0; i < a->count(); ++i)
+        arrstr << (i ? " " : "") << a->data()[i];
+    arrstr << "]";
+    return arrstr.str();
+}
+
+string print_i64_array(I64Array *a) {
+    ostringstream arrstr;
+    arrstr << "#i64[";
+    for (size_t i = 0; i < a->count(); ++i)
+        arrstr << (i ? " " : "") << a->data()[i];
+    arrstr << "]";
+    return arrstr.str();
+}
+
 string print_symbol(Symbol *sym) {
-    return sym->name();
+    return sym->name().str();
+}
+
+// Quoted, escaped so the reader gets the same text back.
+string print_string(String *s) {
+    string out("\"");
+    s->each_piece([&](StringRef piece) {
+        for (char c : piece) {
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            case '\0': out += "\\0"; break;
+            default: out += c;
+            }
+        }
+    });
+    return out + "\"";
 }
 
 string print_number(Number *n) {
@@ -41,12 +97,105 @@ string print_number(Number *n) {
 
 string print_int(Int *i) {
     ostringstream intstr;
-    intstr << dec << i->long_val();
+    intstr << dec << long_val(i);
     return intstr.str();
 }
 
 string print_float(Float *f) {
     ostringstream floatstr;
-    floatstr << f->double_val();
+    floatstr << double_val(f);
     return floatstr.str();
 }
+
+inline void put_varint(string &out, unsigned long v) {
+    while (v >= 0x80) {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+string print_binary(const FormVector &forms) {
+    // A list or vector is queued as its elements, a list's tail if dotted,
+    // and then a marker that emits the op once they have all been written.
+    struct Work {
+        Form *form;
+        size_t close;   // element count + 1 for a marker, else 0
+        BinaryOp op;    // the marker's op
+    };
+
+    vector<Symbol*> syms;
+    vector<unsigned> sym_index;
+    string code;
+    vector<Work, gc_allocator<Work> > stack;
+    FormVector elems;
+
+    for (auto fi = forms.rbegin(); fi != forms.rend(); ++fi)
+        stack.push_back(Work { *fi, 0, BIN_NIL });
+
+    while (! stack.empty()) {
+        Work w = stack.back();
+        stack.pop_back();
+
+        if (w.close) {
+            code += (char)w.op;
+            put_varint(code, w.close - 1);
+            continue;
+        }
+
+        Form *f = w.form;
+        if (f == NIL) {
+            code += (char)BIN_NIL;
+        } else if (Pair *p = dyn_cast<Pair>(f)) {
+            elems.clear();
+            Form *rest = p;
+            for (Pair *cell; (cell = dyn_cast_or_null<Pair>(rest)); rest = cell->cdr())
+                elems.push_back(cell->car());
+
+            stack.push_back(Work { nullptr, elems.size() + 1, rest != NIL ? BIN_DOTTED : BIN_LIST });
+            if (rest != NIL)
+                stack.push_back(Work { rest, 0, BIN_NIL });
+            for (auto ei = elems.rbegin(); ei != elems.rend(); ++ei)
+                stack.push_back(Work { *ei, 0, BIN_NIL });
+        } else if (Vector *v = dyn_cast<Vector>(f)) {
+            stack.push_back(Work { nullptr, v->count() + 1, BIN_VECTOR });
+            for (size_t i = v->count(); i-- > 0; )
+                stack.push_back(Work { v->nth(i), 0, BIN_NIL });
+        } else if (Symbol *sym = dyn_cast<Symbol>(f)) {
+            if (sym->id() >= sym_index.size())
+                sym_index.resize(sym->id() + 1, 0);
+            if (! sym_index[sym->id()]) {
+                syms.push_back(sym);
+                sym_index[sym->id()] = syms.size();
+            }
+            code += (char)BIN_SYM;
+            put_varint(code, sym_index[sym->id()] - 1);
+        } else if (String *str = dyn_cast<String>(f)) {
+            code += (char)BIN_STRING;
+            put_varint(code, str->size());
+            str->each_piece([&](StringRef piece) { code.append(piece.data(), piece.size()); });
+        } else if (Int *i = dyn_cast<Int>(f)) {
+            long l = long_val(i);
+            code += (char)BIN_INT;
+            put_varint(code, ((unsigned long)l << 1) ^ (unsigned long)(l >> 63));
+        } else if (Float *fl = dyn_cast<Float>(f)) {
+            double d = double_val(fl);
+            unsigned long bits;
+            memcpy(&bits, &d, sizeof(bits));
+            code += (char)BIN_FLOAT;
+            for (int b = 0; b < 8; ++b)
+                code += (char)(bits >> (8 * b));
+        } else {
+            throw TypeError("Cannot write form to a binary image", f);
+        }
+    }
+
+    string out("WMBF\x01", 5);
+    put_varint(out, syms.size());
+    for (Symbol *sym : syms) {
+        put_varint(out, sym->name().size());
+        out.append(sym->name().data(), sym->name().size());
+    }
+    put_varint(out, forms.size());
+    return out + code;
+}
@@ -1,150 +1,722 @@
 #include "lisp.h"
 
 #include <cctype>
-#include <sstream>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <thread>
 
-inline bool is_whitespace(char c) {
+inline bool is_whitespace(int c) {
     return isspace(c) || c == ',';
 }
 
-inline char killws(istream &input) {
-    char c;
-    while (is_whitespace(c = input.get()));
-    return c;
+inline bool is_sym_char(int c) {
+    return c != EOF && !is_whitespace(c) && c != '(' && c != ')' && c != '[' && c != ']' && c != '"';
 }
 
-inline bool is_sym_char(char c) {
-    return !is_whitespace(c) && c != '(' && c != ')';
+// Block classifiers for the buffered paths. Each vector step classifies
+// 32 (AVX2) or 16 (SSE2) bytes at once; the scalar loops finish the tail
+// and are all a build without SSE2 gets. Bytes >= 0x80 are negative as
+// signed chars, so the 9..13 range test never matches them, agreeing with
+// isspace in the C locale.
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+inline unsigned ws_mask32(__m256i v) {
+    __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))),
+        _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                         _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v)));
+    return _mm256_movemask_epi8(ws);
 }
 
-Form *read_number(istream &input) {
-    stringstream num_stream;
-    char cur = input.get(), sign = '\0';
-    num_stream << cur;
-    
-    if (cur == '-' || cur == '+') {
-        sign = cur;
-        cur = input.get();
-        num_stream << cur;
-    }
-        
-    if (cur == '0') {
-        if (!is_sym_char(input.peek()))
-            return new Int(0);
-        
-        cur = input.get();
-        num_stream << cur;
-        
-        char dispatch = cur;
-                
-        while (is_sym_char(cur = input.get()))
-            num_stream << cur;
-        input.putback(cur);
-
-        Number *rval;
-        if (dispatch == '.') {
-            double d;
-            num_stream >> d;
-            rval = new Float(d);
-        } else {
-            long l;
-
-            if (dispatch == 'x' || dispatch == 'X')
-                num_stream >> hex >> l;
-            else if (isdigit(dispatch))
-                num_stream >> oct >> l;
-
-            rval = new Int(l);
-        }
-
-        if (!num_stream.eof())
-            throw ReaderError("Invalid number format: ", num_stream.str());
-
-        return rval;
-    } else if (isdigit(cur)) {
-        bool is_float = false;
-        while (is_sym_char(cur = input.get())) {
-            num_stream << cur;
-            if (cur == '.')
-                is_float = true;
-        }
-        input.putback(cur);
-        
-        Number *rval;
-        if (is_float) {
-            double num;
-            num_stream >> num;
-            rval = new Float(num);
+inline unsigned delim_mask32(__m256i v) {
+    __m256i parens = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')),
+                                     _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+    __m256i brackets = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')),
+                                       _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')));
+    __m256i quote = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+    return ws_mask32(v) | _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(parens, brackets), quote));
+}
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+inline unsigned ws_mask16(__m128i v) {
+    __m128i ws = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+        _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                      _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1))));
+    return _mm_movemask_epi8(ws);
+}
+
+inline unsigned delim_mask16(__m128i v) {
+    __m128i parens = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('(')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+    __m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')),
+                                    _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+    __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+    return ws_mask16(v) | _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(parens, brackets), quote));
+}
+#endif
+
+// First byte in [p, end) that is not whitespace.
+inline const char *skip_whitespace(const char *p, const char *end) {
+#if defined(__AVX2__)
+    for (; end - p >= 32; p += 32) {
+        unsigned m = ~ws_mask32(_mm256_loadu_si256((const __m256i *)p));
+        if (m) return p + __builtin_ctz(m);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; end - p >= 16; p += 16) {
+        unsigned m = ~ws_mask16(_mm_loadu_si128((const __m128i *)p)) & 0xffff;
+        if (m) return p + __builtin_ctz(m);
+    }
+#endif
+    while (p < end && is_whitespace((unsigned char)*p))
+        ++p;
+    return p;
+}
+
+// First byte in [p, end) that ends a symbol or number token.
+inline const char *find_delimiter(const char *p, const char *end) {
+#if defined(__AVX2__)
+    for (; end - p >= 32; p += 32) {
+        unsigned m = delim_mask32(_mm256_loadu_si256((const __m256i *)p));
+        if (m) return p + __builtin_ctz(m);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; end - p >= 16; p += 16) {
+        unsigned m = delim_mask16(_mm_loadu_si128((const __m128i *)p));
+        if (m) return p + __builtin_ctz(m);
+    }
+#endif
+    while (p < end && is_sym_char((unsigned char)*p))
+        ++p;
+    return p;
+}
+
+int Reader::killws() {
+    _cur = skip_whitespace(_cur, _end);
+    return get();
+}
+
+bool Reader::at_end() {
+    if (killws() == EOF)
+        return true;
+    unget();
+    return false;
+}
+
+inline int digit_val(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 16;
+}
+
+// Consumes the whole of [p, end) as digits in base, rejecting empty runs
+// and anything past ULONG_MAX.
+inline bool scan_digits(const char *p, const char *end, unsigned base, unsigned long &acc) {
+    if (p == end)
+        return false;
+    acc = 0;
+    for (; p < end; ++p) {
+        unsigned d = digit_val(*p);
+        if (d >= base || acc > (ULONG_MAX - d) / base)
+            return false;
+        acc = acc * base + d;
+    }
+    return true;
+}
+
+// digits '.' digits* ([eE] [+-]? digits+)?, then strtod on a stack copy.
+inline bool scan_float(const char *begin, const char *end, double &d) {
+    const char *p = begin;
+    if (*p == '-' || *p == '+') ++p;
+    const char *int_part = p;
+    while (p < end && digit_val(*p) < 10) ++p;
+    if (p == int_part || p == end || *p++ != '.')
+        return false;
+    while (p < end && digit_val(*p) < 10) ++p;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        if (++p < end && (*p == '-' || *p == '+')) ++p;
+        const char *exp = p;
+        while (p < end && digit_val(*p) < 10) ++p;
+        if (p == exp)
+            return false;
+    }
+    if (p != end)
+        return false;
+
+    char buf[128];
+    size_t len = end - begin;
+    if (len >= sizeof(buf)) {
+        d = strtod(string(begin, end).c_str(), nullptr);
+        return true;
+    }
+    memcpy(buf, begin, len);
+    buf[len] = '\0';
+    d = strtod(buf, nullptr);
+    return true;
+}
+
+bool scan_number(const char *begin, const char *end, NumberLiteral &out) {
+    const char *p = begin;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    if (p == end || digit_val(*p) >= 10)
+        return false;
+
+    unsigned base = 10;
+    if (p[0] == '0' && p + 1 < end) {
+        if (p[1] == 'x' || p[1] == 'X') {
+            base = 16;
+            p += 2;
+        } else if (p[1] != '.') {
+            base = 8;
+            ++p;
+        }
+    }
+
+    if (base == 10 && memchr(p, '.', end - p)) {
+        out.kind = NumberLiteral::NL_Float;
+        return scan_float(begin, end, out.d);
+    }
+
+    unsigned long acc;
+    if (! scan_digits(p, end, base, acc))
+        return false;
+    if (acc > (neg ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX))
+        return false;
+
+    out.kind = NumberLiteral::NL_Int;
+    out.l = neg ? (long)(0 - acc) : (long)acc;
+    return true;
+}
+
+Form *Reader::read_number() {
+    const char *start = _cur;
+    int cur = get();
+
+    if (cur == '-' || cur == '+')
+        cur = get();
+
+    if (! isdigit(cur)) {
+        _cur = start;
+        return read_symbol();
+    }
+
+    _cur = find_delimiter(_cur, _end);
+
+    NumberLiteral lit;
+    if (! scan_number(start, _cur, lit))
+        throw ReaderError("Invalid number format: ", string(start, _cur));
+
+    if (lit.kind == NumberLiteral::NL_Float)
+        return literal_float(lit.d);
+    return make_int(lit.l);
+}
+
+Symbol *Reader::read_symbol() {
+    const char *start = _cur;
+    _cur = find_delimiter(_cur, _end);
+    return Symbol::intern(StringRef(start, _cur - start));
+}
+
+// Strings without escapes, the usual case, are copied straight out of the
+// buffer.
+String *Reader::read_string() {
+    const char *start = _cur;
+    const char *p = start;
+    while (p < _end && *p != '"' && *p != '\\')
+        ++p;
+    if (p < _end && *p == '"') {
+        _cur = p + 1;
+        return String::make(StringRef(start, p - start));
+    }
+
+    string text(start, p);
+    for (_cur = p; _cur < _end; ) {
+        char c = *_cur++;
+        if (c == '"')
+            return String::make(text);
+        if (c != '\\') {
+            text += c;
+            continue;
+        }
+        if (_cur == _end)
+            break;
+        switch (char e = *_cur++) {
+        case 'n': text += '\n'; break;
+        case 't': text += '\t'; break;
+        case 'r': text += '\r'; break;
+        case '0': text += '\0'; break;
+        case '"': case '\\': text += e; break;
+        default:
+            throw ReaderError("Unknown escape in string: \\", string(1, e));
+        }
+    }
+    throw ReaderError("Unexpected end of input in string");
+}
+
+Form *Reader::read_atom() {
+    int cur = peek();
+
+    if (isdigit(cur) || cur == '-' || cur == '+')
+        return read_number();
+    if (is_sym_char(cur))
+        return read_symbol();
+
+    const char *extra = _cur;
+    while (_cur < _end && !is_whitespace((unsigned char)*_cur))
+        ++_cur;
+    throw ReaderError("Extraneous input: ", string(extra, _cur));
+}
+
+Form *Reader::read_nested(bool in_list) {
+    _stack.clear();
+    _items.clear();
+    if (in_list)
+        _stack.push_back(Frame { Frame::RF_List, 0, NIL });
+
+    for (;;) {
+        Form *val;
+        int cur = killws();
+
+        if (cur == EOF) {
+            for (Frame &fr : _stack)
+                if (fr.kind == Frame::RF_Vector)
+                    throw ReaderError("Unexpected end of input in vector");
+                else if (fr.kind != Frame::RF_Quote)
+                    throw ReaderError("Unexpected end of input in list");
+            throw ReaderError("Unexpected end of input");
+        }
+
+        Frame *top = _stack.empty() ? nullptr : &_stack.back();
+
+        if (top && top->kind == Frame::RF_DotClose) {
+            if (cur != ')')
+                throw ReaderError("only one element may succeed '.' in an irregular list");
+            val = list_from_array(_items.data() + top->base, _items.size() - top->base, top->tail);
+            _items.resize(top->base);
+            _stack.pop_back();
+        } else if (cur == '(') {
+            _stack.push_back(Frame { Frame::RF_List, _items.size(), NIL });
+            continue;
+        } else if (cur == ')' && top && top->kind == Frame::RF_List) {
+            val = list_from_array(_items.data() + top->base, _items.size() - top->base);
+            _items.resize(top->base);
+            _stack.pop_back();
+        } else if (cur == '[') {
+            _stack.push_back(Frame { Frame::RF_Vector, _items.size(), NIL });
+            continue;
+        } else if (cur == ']' && top && top->kind == Frame::RF_Vector) {
+            val = Vector::make(_items.data() + top->base, _items.size() - top->base);
+            _items.resize(top->base);
+            _stack.pop_back();
+        } else if (cur == '.' && top && top->kind == Frame::RF_List && _items.size() > top->base) {
+            top->kind = Frame::RF_Dot;
+            continue;
+        } else if (cur == '\'') {
+            _stack.push_back(Frame { Frame::RF_Quote, 0, NIL });
+            continue;
+        } else if (cur == '"') {
+            val = read_string();
         } else {
-            long num;
-            num_stream >> num;
-            rval = new Int(num);
+            unget();
+            val = read_atom();
         }
-                    
-        if (!num_stream.eof())
-            throw ReaderError("Invalid number format: ", num_stream.str());
 
-        return rval;
-    } else {
-        input.putback(cur);
-        if (sign) input.putback(sign);
-        return read_symbol(input);
+        // Hand the finished form to whatever is waiting on it, closing
+        // quotes as we go.
+        for (;;) {
+            if (_stack.empty())
+                return val;
+
+            Frame &fr = _stack.back();
+            if (fr.kind == Frame::RF_Quote) {
+                _stack.pop_back();
+                val = list2(Symbol::QUOTE, val);
+                continue;
+            }
+            if (fr.kind == Frame::RF_Dot) {
+                fr.tail = val;
+                fr.kind = Frame::RF_DotClose;
+            } else {
+                _items.push_back(val);
+            }
+            break;
+        }
     }
 }
 
-Symbol *read_symbol(istream &input) {
-    string sym;
-    char cur = input.get();
-    while(is_sym_char(cur)) {
-        sym += cur;
-        cur = input.get();
-    } 
-    input.putback(cur);
-    return Symbol::intern(sym);
+Pair *Reader::read_list() {
+    return cast_or_null<Pair>(read_nested(true));
 }
 
-Pair *read_list(istream &input) {
-    char cur = killws(input);
+Form *Reader::read_form() {
+    return read_nested(false);
+}
+
+size_t FormSplitter::rebase() {
+    size_t consumed = pending() ? _start : _pos;
+    _pos -= consumed;
+    if (pending())
+        _start = 0;
+    return consumed;
+}
 
-    if (cur == ')')
-        return (Pair*)NIL;
-    
-    input.putback(cur);
-    Form *car = read_form(input);
-    cur = killws(input);
-    Form *cdr;
-    if (cur == '.') {
-        cdr = read_form(input);
-        cur = killws(input);
-        if (cur != ')')
-            throw ReaderError("only one element may succeed '.' in an irregular list");
-    } else {
-        input.putback(cur);
-        cdr = read_list(input);
+bool FormSplitter::take(size_t &start, size_t &end) {
+    start = _start;
+    end = _pos;
+    _start = string::npos;
+    return true;
+}
+
+bool FormSplitter::next(const char *buf, size_t size, bool eof, size_t &start, size_t &end) {
+    const char *buf_end = buf + size;
+
+    while (_pos < size) {
+        if (_in_atom) {
+            _pos = find_delimiter(buf + _pos, buf_end) - buf;
+            if (_pos == size)
+                break;
+            _in_atom = false;
+            return take(start, end);
+        }
+
+        int c = (unsigned char)buf[_pos++];
+
+        if (_in_string) {
+            if (_escaped)
+                _escaped = false;
+            else if (c == '\\')
+                _escaped = true;
+            else if (c == '"') {
+                _in_string = false;
+                if (_depth == 0)
+                    return take(start, end);
+            }
+            continue;
+        }
+
+        // Brackets aren't matched against their kind here; the Reader
+        // rejects a mismatch when it parses the form.
+        if (_depth > 0) {
+            if (c == '"')
+                _in_string = true;
+            else if (c == '(' || c == '[')
+                ++_depth;
+            else if ((c == ')' || c == ']') && --_depth == 0)
+                return take(start, end);
+            continue;
+        }
+
+        if (is_whitespace(c)) {
+            _pos = skip_whitespace(buf + _pos, buf_end) - buf;
+            continue;
+        }
+        if (! pending())
+            _start = _pos - 1;
+        if (c == '\'')
+            continue;
+        if (c == '"')
+            _in_string = true;
+        else if (c == '(' || c == '[')
+            _depth = 1;
+        else if (c == ')' || c == ']')
+            return take(start, end);
+        else
+            _in_atom = true;
+    }
+
+    if (! (eof && pending()))
+        return false;
+    _in_atom = false;
+    _in_string = false;
+    _escaped = false;
+    _depth = 0;
+    return take(start, end);
+}
+
+void IncrementalReader::feed(const char *data, size_t len) {
+    _buf.erase(0, _split.rebase());
+    _buf.append(data, len);
+}
+
+bool IncrementalReader::next(Form *&out) {
+    size_t start, end;
+    if (! _split.next(_buf.data(), _buf.size(), _eof, start, end))
+        return false;
+
+    Reader reader(_buf.data() + start, _buf.data() + end);
+    out = reader.read_form();
+    return true;
+}
+
+// Below this many bytes a single thread finishes before the others start.
+static const size_t PARALLEL_READ_MIN = 1 << 20;
+
+FormVector read_forms(const char *begin, const char *end, unsigned threads) {
+    FormVector forms;
+
+    if (threads < 2 || (size_t)(end - begin) < PARALLEL_READ_MIN) {
+        Reader reader(begin, end);
+        while (! reader.at_end())
+            forms.push_back(reader.read_form());
+        return forms;
+    }
+
+    vector<pair<size_t, size_t> > spans;
+    FormSplitter split;
+    size_t start, stop;
+    while (split.next(begin, end - begin, true, start, stop))
+        spans.push_back(make_pair(start, stop));
+
+    forms.resize(spans.size());
+
+    // Hand each thread a run of consecutive forms of roughly equal size.
+    vector<size_t> cuts(1, 0);
+    size_t share = (end - begin) / threads + 1, taken = 0;
+    for (size_t i = 0; i < spans.size(); ++i) {
+        if (spans[i].first >= taken + share) {
+            cuts.push_back(i);
+            taken = spans[i].first;
+        }
     }
+    cuts.push_back(spans.size());
 
-    return new Pair(car, cdr);
+    vector<exception_ptr> errors(cuts.size() - 1);
+    vector<thread> workers;
+    GC_allow_register_threads();
+
+    for (size_t w = 0; w + 1 < cuts.size(); ++w) {
+        workers.push_back(thread([&, w]() {
+            GC_stack_base sb;
+            GC_get_stack_base(&sb);
+            GC_register_my_thread(&sb);
+            try {
+                for (size_t i = cuts[w]; i < cuts[w + 1]; ++i) {
+                    Reader reader(begin + spans[i].first, begin + spans[i].second);
+                    forms[i] = reader.read_form();
+                }
+            } catch (...) {
+                errors[w] = current_exception();
+            }
+            small_alloc_release();
+            GC_unregister_my_thread();
+        }));
+    }
+
+    for (thread &t : workers)
+        t.join();
+    // Report the first bad form in the file, as a sequential read would.
+    for (exception_ptr &e : errors)
+        if (e)
+            rethrow_exception(e);
+
+    return forms;
+}
+
+bool is_binary(const char *begin, const char *end) {
+    return end - begin >= 5 && memcmp(begin, "WMBF\x01", 5) == 0;
+}
+
+// At most ten bytes; the tenth may only carry bit 63.
+inline unsigned long get_varint(const char *&p, const char *end) {
+    unsigned long v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char b = *p++;
+        if (shift == 63 && b > 1)
+            break;
+        v |= (unsigned long)(b & 0x7f) << shift;
+        if (! (b & 0x80))
+            return v;
+    }
+    throw ReaderError("Corrupt binary image: bad varint");
+}
+
+FormVector read_binary(const char *begin, const char *end) {
+    if (! is_binary(begin, end))
+        throw ReaderError("Not a binary image");
+    const char *p = begin + 5;
+
+    // Every symbol and form takes at least a byte, so a count larger than
+    // what is left can only come from a corrupt image.
+    unsigned long nsyms = get_varint(p, end);
+    if (nsyms > (unsigned long)(end - p))
+        throw ReaderError("Corrupt binary image: bad symbol count");
+    vector<Symbol*> syms(nsyms);
+    for (Symbol *&sym : syms) {
+        unsigned long len = get_varint(p, end);
+        if (len > (unsigned long)(end - p))
+            throw ReaderError("Corrupt binary image: truncated symbol");
+        sym = Symbol::intern(StringRef(p, len));
+        p += len;
+    }
+
+    unsigned long nforms = get_varint(p, end);
+    if (nforms > (unsigned long)(end - p))
+        throw ReaderError("Corrupt binary image: bad form count");
+    FormVector stack;
+
+    while (p < end) {
+        switch (*p++) {
+        case BIN_NIL:
+            stack.push_back(NIL);
+            break;
+        case BIN_SYM: {
+            unsigned long idx = get_varint(p, end);
+            if (idx >= syms.size())
+                throw ReaderError("Corrupt binary image: bad symbol index");
+            stack.push_back(syms[idx]);
+            break;
+        }
+        case BIN_INT: {
+            unsigned long z = get_varint(p, end);
+            stack.push_back(make_int((long)(z >> 1) ^ -(long)(z & 1)));
+            break;
+        }
+        case BIN_FLOAT: {
+            if (end - p < 8)
+                throw ReaderError("Corrupt binary image: truncated float");
+            unsigned long bits = 0;
+            for (int b = 0; b < 8; ++b)
+                bits |= (unsigned long)(unsigned char)p[b] << (8 * b);
+            p += 8;
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            stack.push_back(literal_float(d));
+            break;
+        }
+        case BIN_LIST:
+        case BIN_DOTTED: {
+            bool dotted = p[-1] == BIN_DOTTED;
+            unsigned long n = get_varint(p, end);
+            if (n > stack.size() || dotted > stack.size() - n)
+                throw ReaderError("Corrupt binary image: stack underflow");
+            Form *tail = NIL;
+            if (dotted) {
+                tail = stack.back();
+                stack.pop_back();
+            }
+            Form *list = list_from_array(stack.data() + stack.size() - n, n, tail);
+            stack.resize(stack.size() - n);
+            stack.push_back(list);
+            break;
+        }
+        case BIN_STRING: {
+            unsigned long len = get_varint(p, end);
+            if (len > (unsigned long)(end - p))
+                throw ReaderError("Corrupt binary image: truncated string");
+            stack.push_back(String::make(StringRef(p, len)));
+            p += len;
+            break;
+        }
+        case BIN_VECTOR: {
+            unsigned long n = get_varint(p, end);
+            if (n > stack.size())
+                throw ReaderError("Corrupt binary image: stack underflow");
+            Vector *v = Vector::make(stack.data() + stack.size() - n, n);
+            stack.resize(stack.size() - n);
+            stack.push_back(v);
+            break;
+        }
+        default:
+            throw ReaderError("Corrupt binary image: unknown op");
+        }
+    }
+
+    if (stack.size() != nforms)
+        throw ReaderError("Corrupt binary image: form count mismatch");
+    return stack;
+}
+
+inline void skip_ws(istream &input) {
+    while (is_whitespace(input.peek()))
+        input.get();
+}
+
+inline void collect_atom(istream &input, string &buf) {
+    while (is_sym_char(input.peek()))
+        buf += (char)input.get();
+}
+
+// Copies the rest of a string, through its closing '"'.
+inline void collect_string(istream &input, string &buf) {
+    int c;
+    while ((c = input.get()) != EOF) {
+        buf += (char)c;
+        if (c == '"')
+            return;
+        if (c == '\\' && (c = input.get()) != EOF)
+            buf += (char)c;
+    }
+}
+
+// Copies up to and including the ')' or ']' that brings depth back to zero.
+inline void collect_list(istream &input, string &buf, int depth) {
+    int c;
+    while (depth > 0 && (c = input.get()) != EOF) {
+        buf += (char)c;
+        if (c == '"') collect_string(input, buf);
+        else if (c == '(' || c == '[') ++depth;
+        else if (c == ')' || c == ']') --depth;
+    }
+}
+
+inline void collect_form(istream &input, string &buf) {
+    skip_ws(input);
+    while (input.peek() == '\'') {
+        buf += (char)input.get();
+        skip_ws(input);
+    }
+
+    int c = input.peek();
+    if (c == '(' || c == '[') {
+        buf += (char)input.get();
+        collect_list(input, buf, 1);
+    } else if (c == '"') {
+        buf += (char)input.get();
+        collect_string(input, buf);
+    } else if (is_sym_char(c))
+        collect_atom(input, buf);
+    else if (c != EOF)
+        buf += (char)input.get();
 }
 
 Form *read_form(istream &input) {
-    char cur = killws(input);
-
-    if (isdigit(cur) || cur == '-' || cur == '+') {
-        input.putback(cur);
-        return read_number(input);
-    }
-    if (cur == '(')
-        return read_list(input);
-    if (cur == '\'') {
-        Form *f = read_form(input);
-        return cons(Symbol::intern("quote"), cons(f, NIL));
-    } if (is_sym_char(cur)) {
-        input.putback(cur);
-        return read_symbol(input);
-    }
-
-    input.putback(cur);
-    string extra;
-    input >> extra;
-    throw ReaderError(string("Extraneous input: ") + extra);
+    string buf;
+    collect_form(input, buf);
+    Reader reader(buf);
+    return reader.read_form();
+}
+
+Pair *read_list(istream &input) {
+    string buf("(");
+    collect_list(input, buf, 1);
+    Reader reader(buf);
+    return cast_or_null<Pair>(reader.read_form());
+}
+
+Form *read_number(istream &input) {
+    string buf;
+    collect_atom(input, buf);
+    Reader reader(buf);
+    return reader.read_number();
+}
+
+Symbol *read_symbol(istream &input) {
+    string buf;
+    collect_atom(input, buf);
+    Reader reader(buf);
+    return reader.read_symbol();
 }
@@ -0,0 +1,122 @@
+#include "lisp.h"
+
+#include <cstdio>
+#include <cstring>
+
+String *String::alloc_flat(size_t len) {
+    if (len > UINT_MAX)
+        throw LispException("String too long.");
+    // Text only, so the collector needn't scan it. Atomic memory isn't
+    // cleared; the constructor and the caller fill every byte.
+    void *mem = GC_MALLOC_ATOMIC(sizeof(String) + len + 1);
+    if (! mem)
+        throw bad_alloc();
+    String *s = new (mem) String(false, len);
+    ((char *)(s + 1))[len] = '\0';
+    return s;
+}
+
+String *String::make(StringRef text) {
+    String *s = alloc_flat(text.size());
+    memcpy((char *)(s + 1), text.data(), text.size());
+    return s;
+}
+
+String *String::concat(String *a, String *b) {
+    if (! a->size()) return b;
+    if (! b->size()) return a;
+
+    size_t len = a->size() + b->size();
+    if (len > UINT_MAX)
+        throw LispException("String too long.");
+
+    if (len <= FLAT_MAX) {
+        String *s = alloc_flat(len);
+        char *out = (char *)(s + 1);
+        auto append = [&](StringRef piece) {
+            memcpy(out, piece.data(), piece.size());
+            out += piece.size();
+        };
+        a->each_piece(append);
+        b->each_piece(append);
+        return s;
+    }
+
+    // Text built a little at a time would otherwise be one node per piece:
+    // fold a short addition into the short leaf it follows.
+    if (a->_rope && b->flat()) {
+        String *right = a->halves()[1];
+        if (right->flat() && right->size() + b->size() <= FLAT_MAX)
+            return concat(a->halves()[0], concat(right, b));
+    }
+
+    String *s = new (small_alloc(sizeof(String) + 2 * sizeof(String*))) String(true, len);
+    s->halves()[0] = a;
+    s->halves()[1] = b;
+    return s;
+}
+
+string String::str() {
+    string out;
+    out.reserve(size());
+    each_piece([&](StringRef piece) { out.append(piece.data(), piece.size()); });
+    return out;
+}
+
+// FNV-1a, which can be fed a piece at a time. Cached; 0 is kept to mean
+// not yet computed.
+size_t String::hash() {
+    if (! _hash) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        each_piece([&](StringRef piece) {
+            for (unsigned char c : piece)
+                h = (h ^ c) * 0x100000001b3ULL;
+        });
+        _hash = h ? h : 1;
+    }
+    return _hash;
+}
+
+// Appends the text str and print use for f.
+static String *text_of(String *acc, Form *f) {
+    if (f == NIL)
+        return acc;
+    if (String *s = dyn_cast<String>(f))
+        return String::concat(acc, s);
+    return String::concat(acc, String::make(print_form(f)));
+}
+
+Form *builtin_str(Form **args, long n) try {
+    String *acc = String::make("");
+    for (long i = 0; i < n; ++i)
+        acc = text_of(acc, args[i]);
+    return acc;
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+static void write_text(Form **args, long n) {
+    for (long i = 0; i < n; ++i) {
+        if (i)
+            fputc(' ', stdout);
+        if (String *s = dyn_cast_or_null<String>(args[i]))
+            s->each_piece([](StringRef piece) { fwrite(piece.data(), 1, piece.size(), stdout); });
+        else if (args[i])
+            fputs(print_form(args[i]).c_str(), stdout);
+    }
+}
+
+Form *builtin_print(Form **args, long n) try {
+    write_text(args, n);
+    return NIL;
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_println(Form **args, long n) try {
+    write_text(args, n);
+    fputc('\n', stdout);
+    return NIL;
+} catch (...) {
+    return hold_error<Form*>();
+}
@@ -0,0 +1,3 @@
+(println ((fn twice (n) (if (<= n 0) 0 (do (twice 0) (* n 2)))) 3))
+(println ((fn twice (n) (if (<= n 0) 0 (do (twice 0) (* n 2)))) 1.5))
+(println ((fn halve (n) (if (< n 1) 0.5 (do (halve 0) (/ n 2)))) 4))
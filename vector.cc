@@ -0,0 +1,110 @@
+#include "lisp.h"
+
+#include <cstring>
+
+Vector *Vector::make(size_t n) {
+    if (n > UINT_MAX)
+        throw LispException("Vector too large.");
+    void *mem = small_alloc(sizeof(Vector) + n * sizeof(Form*));
+    Vector *v = new (mem) Vector(n);
+    memset(v->elems(), 0, n * sizeof(Form*));
+    return v;
+}
+
+Vector *Vector::make(Form *const *elems, size_t n) {
+    Vector *v = make(n);
+    memcpy(v->elems(), elems, n * sizeof(Form*));
+    return v;
+}
+
+// Accepts any integer, boxed or not, that is a valid position below limit.
+static size_t index_val(Form *index, size_t limit, const char *op) {
+    Int *i = dyn_cast_or_null<Int>(index);
+    if (! i)
+        throw TypeError(string(op) + " index must be an integer", index);
+    long l = long_val(i);
+    if (l < 0 || (unsigned long)l >= limit)
+        throw IndexError(string(op) + " index out of bounds: " + print_int(i));
+    return l;
+}
+
+Form *builtin_nth(Form *coll, Form *index) try {
+    if (Vector *v = dyn_cast_or_null<Vector>(coll))
+        return v->nth(index_val(index, v->count(), "nth"));
+    if (dyn_cast_or_null<F64Array>(coll) || dyn_cast_or_null<I64Array>(coll))
+        return builtin_aget(coll, index);
+
+    if (! listp(coll))
+        throw TypeError("nth requires a vector or a proper list", coll);
+    size_t i = index_val(index, count(cast_or_null<Pair>(coll)), "nth");
+    Pair *p = cast<Pair>(coll);
+    while (i--)
+        p = cast<Pair>(p->cdr());
+    return p->car();
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_count(Form *coll) try {
+    if (Vector *v = dyn_cast_or_null<Vector>(coll))
+        return make_int(v->count());
+    if (F64Array *a = dyn_cast_or_null<F64Array>(coll))
+        return make_int(a->count());
+    if (I64Array *a = dyn_cast_or_null<I64Array>(coll))
+        return make_int(a->count());
+    if (String *s = dyn_cast_or_null<String>(coll))
+        return make_int(s->size());
+    if (! listp(coll))
+        throw TypeError("count requires a vector or a proper list", coll);
+    return make_int(count(cast_or_null<Pair>(coll)));
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+// Vectors grow at the end, lists at the front.
+Form *builtin_conj(Form *coll, Form *x) try {
+    if (Vector *v = dyn_cast_or_null<Vector>(coll)) {
+        Vector *nv = Vector::make(v->count() + 1);
+        memcpy(nv->elems(), v->elems(), v->count() * sizeof(Form*));
+        nv->elems()[v->count()] = x;
+        return nv;
+    }
+    if (! listp(coll))
+        throw TypeError("conj requires a vector or a proper list", coll);
+    return cons(x, coll);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+// Replaces one element of a copy; an index one past the end appends.
+Form *builtin_assoc(Form *coll, Form *index, Form *x) try {
+    Vector *v = dyn_cast_or_null<Vector>(coll);
+    if (! v)
+        throw TypeError("assoc requires a vector", coll);
+
+    size_t i = index_val(index, v->count() + 1, "assoc");
+    Vector *nv = Vector::make(i == v->count() ? v->count() + 1 : v->count());
+    memcpy(nv->elems(), v->elems(), v->count() * sizeof(Form*));
+    nv->elems()[i] = x;
+    return nv;
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *vector_of(Form **elems, long n) try {
+    return Vector::make(elems, n);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_cons(Form *a, Form *d) try {
+    return cons(a, d);
+} catch (...) {
+    return hold_error<Form*>();
+}
+
+Form *builtin_list(Form **elems, long n) try {
+    return list_from_array(elems, n);
+} catch (...) {
+    return hold_error<Form*>();
+}